@@ -0,0 +1,155 @@
+#include <hmon.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Measure the cost of monitor reads when each core reads its own monitors, while the main thread snapshots every
+ * monitor as the sampler does. Monitors are created interleaved across cores, as from a configuration file: when
+ * monitors of different cores share cache lines, reads slow down with the number of cores.
+ * Run it on builds before and after a monitor layout change to compare. Shared lines counts the cache lines written
+ * by reads (monitor, events, timestamps and samples) that monitors of several cores share: it does not depend on the
+ * machine, and can be obtained on a synthetic topology, e.g. HWLOC_SYNTHETIC="pack:2 core:8 pu:1".
+ * Compile: cc bench_false_sharing.c -o bench_false_sharing -lhmon -lhwloc -lpthread
+ * Run:     HMON_PERF_PLUGINS=fake ./bench_false_sharing [n_reads]
+ **/
+
+#define MONITORS_PER_CORE 4
+
+struct reader{
+  pthread_t    tid;
+  hwloc_obj_t  core;
+  hmon         monitors[MONITORS_PER_CORE];
+  long long    time;
+};
+
+static pthread_barrier_t start;
+static unsigned n_reads;
+static int finished;   /* Number of readers done */
+
+struct line{
+  unsigned long addr;
+  unsigned      core;
+};
+
+static int line_compare(const void * a, const void * b){
+  const struct line * x = a, * y = b;
+  if(x->addr != y->addr){return x->addr < y->addr ? -1 : 1;}
+  return (x->core > y->core) - (x->core < y->core);
+}
+
+/* Append lines of [p, p+size[ read by core */
+static unsigned add_lines(struct line * lines, unsigned n, const void * p, size_t size, unsigned core){
+  unsigned long a;
+  for(a = (unsigned long)p / 64; a <= ((unsigned long)p + size - 1) / 64; a++){lines[n].addr = a; lines[n++].core = core;}
+  return n;
+}
+
+/* Count cache lines written by reads of monitors of different cores */
+static unsigned shared_lines(struct reader * readers, unsigned n_cores){
+  unsigned i, j, k, n = 0, shared = 0;
+  hmon m;
+  struct line * lines = malloc(sizeof(*lines) * n_cores * MONITORS_PER_CORE * 64);
+  for(i=0; i<n_cores; i++){
+    for(j=0; j<MONITORS_PER_CORE; j++){
+      m = readers[i].monitors[j];
+      n = add_lines(lines, n, m, sizeof(*m), i);
+      n = add_lines(lines, n, m->events, sizeof(double) * m->capacity * m->n_events, i);
+      n = add_lines(lines, n, m->timestamps, sizeof(int64_t) * m->capacity, i);
+      n = add_lines(lines, n, m->samples, sizeof(double) * m->n_samples, i);
+    }
+  }
+  qsort(lines, n, sizeof(*lines), line_compare);
+  /* Lines sorted by address then core: a line is shared if its first and last readers differ */
+  for(i=0; i<n; i=k){
+    for(k=i+1; k<n && lines[k].addr == lines[i].addr; k++);
+    if(lines[k-1].core != lines[i].core){shared++;}
+  }
+  free(lines);
+  return shared;
+}
+
+static long long timestamp(){
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return 1000000000LL * tp.tv_sec + tp.tv_nsec;
+}
+
+static void * reader_thread(void * arg){
+  struct reader * r = arg;
+  unsigned i, j;
+  hwloc_set_cpubind(hmon_topology, r->core->cpuset, HWLOC_CPUBIND_THREAD);
+  for(j=0; j<MONITORS_PER_CORE; j++){hmonitor_trylock(r->monitors[j], 1);}
+  pthread_barrier_wait(&start);
+  r->time = timestamp();
+  for(i=0; i<n_reads; i++){
+    for(j=0; j<MONITORS_PER_CORE; j++){
+      hmonitor_read(r->monitors[j]);
+      hmonitor_reduce(r->monitors[j]);
+    }
+  }
+  r->time = timestamp() - r->time;
+  __sync_fetch_and_add(&finished, 1);
+  for(j=0; j<MONITORS_PER_CORE; j++){hmonitor_release(r->monitors[j]);}
+  return NULL;
+}
+
+static void bench(unsigned n_cores, FILE * output){
+  unsigned i, j;
+  long long max = 0, sum = 0;
+  const char * events[1] = {"FAKE"};
+  struct reader * readers = malloc(sizeof(*readers) * n_cores);
+
+  /* Interleave monitors of different cores */
+  for(j=0; j<MONITORS_PER_CORE; j++){
+    for(i=0; i<n_cores; i++){
+      readers[i].core = hwloc_get_obj_by_type(hmon_topology, HWLOC_OBJ_CORE, i);
+      readers[i].monitors[j] = new_hmonitor("fake", readers[i].core, events, 1, 8, NULL, 0, "fake", "hmonitor_events_sum", output);
+      if(readers[i].monitors[j] == NULL){exit(EXIT_FAILURE);}
+    }
+  }
+
+  finished = 0;
+  pthread_barrier_init(&start, NULL, n_cores+1);
+  for(i=0; i<n_cores; i++){pthread_create(&readers[i].tid, NULL, reader_thread, &readers[i]);}
+  pthread_barrier_wait(&start);
+  /* Snapshot monitors while they are read */
+  while(__sync_fetch_and_add(&finished, 0) < (int)n_cores){
+    for(j=0; j<n_cores*MONITORS_PER_CORE; j++){hmonitor_snapshot(readers[j%n_cores].monitors[j/n_cores]);}
+  }
+  for(i=0; i<n_cores; i++){
+    pthread_join(readers[i].tid, NULL);
+    sum += readers[i].time;
+    max = readers[i].time > max ? readers[i].time : max;
+  }
+  pthread_barrier_destroy(&start);
+  printf("%8u %14.1f %14.1f %14u\n", n_cores,
+	 (double)sum / ((double)n_cores * n_reads * MONITORS_PER_CORE),
+	 (double)max / ((double)n_reads * MONITORS_PER_CORE),
+	 shared_lines(readers, n_cores));
+
+  for(i=0; i<n_cores; i++){
+    for(j=0; j<MONITORS_PER_CORE; j++){delete_hmonitor(readers[i].monitors[j]);}
+  }
+  free(readers);
+}
+
+int main(int argc, char ** argv){
+  unsigned n, n_cores;
+  FILE * output;
+  n_reads = argc > 1 ? atoi(argv[1]) : 100000;
+
+  if(hmon_lib_init(NULL, 0) == -1){exit(EXIT_FAILURE);}
+  /* Snapshots are only taken for monitors with an output */
+  output = fopen("/dev/null", "w");
+  n_cores = hwloc_get_nbobjs_by_type(hmon_topology, HWLOC_OBJ_CORE);
+
+  printf("%8s %14s %14s %14s\n", "cores", "mean(ns/read)", "max(ns/read)", "shared lines");
+  for(n = 1; n < n_cores; n*=2){bench(n, output);}
+  bench(n_cores, output);
+
+  fclose(output);
+  hmon_lib_finalize();
+  return 0;
+}
@@ -0,0 +1,73 @@
+#include <hmon.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Measure hmon_update() trigger latency with respect to the number of cores carrying monitors.
+ * One fake monitor is set on each core of a topology restricted to 1, 2, 4 ... cores.
+ * Compile: cc bench_update.c -o bench_update -lhmon -lhwloc
+ * Run:     HMON_PERF_PLUGINS=fake ./bench_update [n_updates]
+ **/
+
+static long long timestamp(){
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return 1000000000LL * tp.tv_sec + tp.tv_nsec;
+}
+
+static void bench(hwloc_topology_t topology, unsigned n_cores, unsigned n_updates){
+  unsigned i;
+  long long t, min = -1, max = 0, sum = 0;
+  hwloc_topology_t restricted;
+  hwloc_cpuset_t cpuset = hwloc_bitmap_alloc();
+  hwloc_obj_t core = NULL;
+  const char * events[1] = {"FAKE"};
+
+  /* Restrict topology to the n_cores first cores */
+  for(i=0; i<n_cores; i++){
+    core = hwloc_get_obj_by_type(topology, HWLOC_OBJ_CORE, i);
+    hwloc_bitmap_or(cpuset, cpuset, core->cpuset);
+  }
+  hwloc_topology_dup(&restricted, topology);
+  hwloc_topology_restrict(restricted, cpuset, 0);
+  hwloc_bitmap_free(cpuset);
+
+  if(hmon_lib_init(restricted, 0) == -1){exit(EXIT_FAILURE);}
+  hwloc_topology_destroy(restricted);
+  core = NULL;
+  while((core = hwloc_get_next_obj_by_type(hmon_topology, HWLOC_OBJ_CORE, core)) != NULL){
+    hmon m = new_hmonitor("fake", core, events, 1, 1, NULL, 0, "fake", NULL, NULL);
+    if(m == NULL || hmon_register_hmonitor(m, 0) == -1){exit(EXIT_FAILURE);}
+  }
+  hmon_start();
+
+  for(i=0; i<n_updates; i++){
+    t = timestamp();
+    hmon_update(0);
+    t = timestamp() - t;
+    sum += t;
+    min = (min < 0 || t < min) ? t : min;
+    max = t > max ? t : max;
+  }
+  printf("%8u %14lld %14lld %14lld\n", n_cores, min, sum/n_updates, max);
+
+  hmon_stop();
+  hmon_lib_finalize();
+}
+
+int main(int argc, char ** argv){
+  unsigned n, n_cores, n_updates = argc > 1 ? atoi(argv[1]) : 10000;
+  hwloc_topology_t topology;
+
+  hwloc_topology_init(&topology);
+  hwloc_topology_load(topology);
+  n_cores = hwloc_get_nbobjs_by_type(topology, HWLOC_OBJ_CORE);
+
+  printf("%8s %14s %14s %14s\n", "cores", "min(ns)", "mean(ns)", "max(ns)");
+  for(n = 1; n < n_cores; n*=2){bench(topology, n, n_updates);}
+  bench(topology, n_cores, n_updates);
+
+  hwloc_topology_destroy(topology);
+  return 0;
+}
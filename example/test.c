@@ -9,7 +9,7 @@ void usage(const char * argv0){
 int main(int argc, char ** argv){
   if(argc!=2){usage(argv[0]); return -1;}
   
-  hmon_lib_init(NULL, NULL);
+  hmon_lib_init(NULL, 0);
   hmon_import_hmonitors(argv[1]);
   hmon_start();
 
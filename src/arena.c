@@ -0,0 +1,108 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./internal.h"
+#include "./hmon.h"
+
+/* Size of arena chunks. Larger allocations get a chunk of their own */
+#define HMON_ARENA_CHUNK (1<<20)
+
+/* Monitor state carved from chunks bound to a set of NUMA nodes. Chunks are released at once with the library */
+struct hmon_arena{
+  hwloc_nodeset_t nodeset;   /* NULL for locations without nodeset: chunks are not bound */
+  harray          chunks;    /* Each chunk starts with a cache line holding its size */
+  char *          cursor;    /* Next free line of last chunk */
+  size_t          left;      /* Bytes left in last chunk */
+};
+
+static harray          arenas = NULL;
+static harray          strings = NULL;   /* Interned strings, sorted */
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct hmon_arena * hmon_arena_lookup(hwloc_const_nodeset_t nodeset){
+  unsigned i;
+  struct hmon_arena * a;
+  if(arenas == NULL){arenas = new_harray(sizeof(struct hmon_arena *), 8, NULL);}
+  for(i=0; i<harray_length(arenas); i++){
+    a = harray_get(arenas, i);
+    if(a->nodeset == nodeset || (a->nodeset != NULL && nodeset != NULL && hwloc_bitmap_isequal(a->nodeset, nodeset))){return a;}
+  }
+  malloc_chk(a, sizeof(*a));
+  a->nodeset = nodeset == NULL ? NULL : hwloc_bitmap_dup(nodeset);
+  a->chunks = new_harray(sizeof(char *), 8, NULL);
+  a->cursor = NULL;
+  a->left = 0;
+  harray_push(arenas, a);
+  return a;
+}
+
+static void hmon_arena_grow(struct hmon_arena * a, size_t size){
+  char * chunk = NULL;
+  size = MAX(HMON_ARENA_CHUNK, size + HMON_CACHE_LINE);
+  if(a->nodeset != NULL){
+    chunk = hwloc_alloc_membind(hmon_topology, size, a->nodeset, HWLOC_MEMBIND_BIND, HWLOC_MEMBIND_BYNODESET);
+  }
+  if(chunk == NULL){chunk = hwloc_alloc(hmon_topology, size);}
+  if(chunk == NULL){perror_EXIT("hwloc_alloc");}
+  *(size_t*)chunk = size;
+  harray_push(a->chunks, chunk);
+  a->cursor = chunk + HMON_CACHE_LINE;
+  a->left = size - HMON_CACHE_LINE;
+}
+
+void * hmon_arena_alloc(hwloc_const_nodeset_t nodeset, size_t size){
+  void * ptr;
+  struct hmon_arena * a;
+  size = HMON_LINES(size);
+  pthread_mutex_lock(&arena_lock);
+  a = hmon_arena_lookup(nodeset);
+  if(a->left < size){hmon_arena_grow(a, size);}
+  ptr = a->cursor;
+  a->cursor += size;
+  a->left -= size;
+  pthread_mutex_unlock(&arena_lock);
+  return ptr;
+}
+
+static int hmon_string_compare(void * a, void * b){
+  return strcmp(*(char**)a, *(char**)b);
+}
+
+const char * hmon_intern(const char * str){
+  int i;
+  char * s;
+  pthread_mutex_lock(&arena_lock);
+  if(strings == NULL){strings = new_harray(sizeof(char *), 64, free);}
+  i = harray_find(strings, (void*)str, hmon_string_compare);
+  if(i >= 0){
+    s = harray_get(strings, i);
+  } else {
+    s = strdup(str);
+    if(s == NULL){perror_EXIT("strdup");}
+    harray_insert_sorted(strings, s, hmon_string_compare);
+  }
+  pthread_mutex_unlock(&arena_lock);
+  return s;
+}
+
+void hmon_arena_finalize(){
+  unsigned i, j;
+  struct hmon_arena * a;
+  char * chunk;
+  if(arenas != NULL){
+    for(i=0; i<harray_length(arenas); i++){
+      a = harray_get(arenas, i);
+      for(j=0; j<harray_length(a->chunks); j++){
+	chunk = harray_get(a->chunks, j);
+	hwloc_free(hmon_topology, chunk, *(size_t*)chunk);
+      }
+      delete_harray(a->chunks);
+      if(a->nodeset != NULL){hwloc_bitmap_free(a->nodeset);}
+      free(a);
+    }
+    delete_harray(arenas);
+    arenas = NULL;
+  }
+  if(strings != NULL){delete_harray(strings);}
+  strings = NULL;
+}
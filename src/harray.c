@@ -104,6 +104,10 @@ inline void harray_push(harray array, void * element){
   harray_set(array,array->length,element);
 }
 
+void harray_reserve(harray array, unsigned length){
+  harray_chk_length(array, length);
+}
+
 void * harray_pop(harray array){
   if(array->length == 0){return NULL;}
   array->length--;
@@ -145,35 +149,21 @@ int harray_find_unsorted(harray array, void * key){
 
 
 unsigned harray_insert_sorted(harray array, void * element, int (* compare)(void*, void*)){
-  unsigned insert_index;
-  unsigned left_bound = 0,right_bound = array->length-1;
-  int comp;
-
-  if(array->length == 0){harray_push(array, element); return 0;}
-  if(array->length == 1){
-    insert_index = compare(&element, &array->cell[0]) > 0 ? 1 : 0;
-    goto insertion;
+  unsigned left_bound = 0, right_bound = array->length, insert_index;
+
+  /* Insert after every element not greater than element */
+  while(left_bound < right_bound){
+    insert_index = left_bound + (right_bound-left_bound)/2;
+    if(compare(&element, &array->cell[insert_index]) < 0){right_bound = insert_index;}
+    else{left_bound = insert_index+1;}
   }
-  
-  insert_index = 1+left_bound + (right_bound-left_bound)/2;
-  
-  do{
-    comp = compare(&element, &array->cell[insert_index]);
-    if(comp > 0){left_bound = insert_index;}
-    else if(comp < 0){right_bound = insert_index;}
-    else{break;}
-    insert_index = 1+left_bound + (right_bound-left_bound)/2;
-  } while(insert_index < right_bound);
-
-insertion:
-  if(insert_index >= array->length){
+
+  if(left_bound >= array->length){
     harray_push(array, element);
     return array->length-1;
   }
-  else{
-    harray_insert(array, insert_index, element);
-    return insert_index;
-  }
+  harray_insert(array, left_bound, element);
+  return left_bound;
 }
 
 inline void harray_sort(harray array, int (* compare)(void*, void*)){
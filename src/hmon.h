@@ -12,10 +12,12 @@ extern hwloc_topology_t hmon_topology;
 /**
  * Initialize the library.
  * @param topology, an optional topology to map monitor on. If topo is NULL the current machine topology is used.
- * @param restrict_obj, a topology object where the library is allowed to spawn threads.
- * @return -1 on error, 0 on success;
+ * @param rt_priority, 0 for default scheduling, or the SCHED_FIFO priority of sampling threads for real-time mode.
+ *        In real-time mode, memory is locked and prefaulted (mlockall), and the library does not allocate memory
+ *        while sampling, unless monitors are registered after hmon_start().
+ * @return -1 on error (e.g. missing privileges for real-time mode), 0 on success;
  **/
-int hmon_lib_init(const hwloc_topology_t topology);
+int hmon_lib_init(const hwloc_topology_t topology, const int rt_priority);
 
 /**
  * Delete all library internal structures.
@@ -24,6 +26,7 @@ void hmon_lib_finalize();
 
 /**
  * Restrict monitor registration into sepcified domain. If monitor outside of domain are already registered, they are deleted.
+ * Sampling threads of cores left without monitors are stopped.
  * @param domain, the domain cpuset to restrict.
  **/
 void hmon_restrict(hwloc_cpuset_t domain);
@@ -56,7 +59,8 @@ int hmon_register_hmonitor(hmon m, int display);
 harray hmon_get_monitors_by_depth(unsigned depth, unsigned logical_index);
 
 /**
- * Start all monitors
+ * Start all monitors.
+ * Sampling threads are spawned here, once monitors are imported, only on allowed cores carrying monitors.
  **/
 void hmon_start();
 
@@ -67,6 +71,8 @@ void hmon_stop();
 
 /**
  * Update and print every created monitor.
+ * A new sampling epoch is published to core threads, and the call returns once every thread is done with it.
+ * If threads are still busy with a previous epoch, the update is skipped or delayed depending on hmon_set_miss_policy().
  * Print format:
  * Id Obj timestamp events...
  * @param output, should update print monitors last sample 
@@ -74,10 +80,133 @@ void hmon_stop();
 void hmon_update(const int output);
 
 /**
- * Check update completion.
+ * Trigger an update of every monitor without waiting for its completion.
+ * Samples of the previous update are saved before, so that they can be printed with hmon_output() 
+ * while the new update is running. Trigger and output functions must be called from a single thread.
+ * @return The epoch handle of the update, or 0 if the previous update is not complete and the update is skipped,
+ *         or if the update is skipped to lower the sampling rate (see hmon_set_max_overhead()).
+ **/
+int hmon_update_async();
+
+/**
+ * Check an update completion.
+ * @param epoch, the handle returned by hmon_update_async().
+ * @return 1 if the update is complete, else 0.
+ **/
+int hmon_poll(const int epoch);
+
+/**
+ * Block until an update is complete.
+ * @param epoch, the handle returned by hmon_update_async().
+ **/
+void hmon_wait(const int epoch);
+
+/**
+ * Print monitors samples of the last complete update, if not already printed.
+ **/
+void hmon_output();
+
+/**
+ * Set or unset free-running mode on registered monitors. Must be called while no update is running.
+ * Free-running monitors are not stopped and restarted around each read: counters never stop counting,
+ * and cumulative eventsets output the difference between two consecutive reads.
+ * @param freerun, 1 to enable free-running mode, 0 to disable it.
+ **/
+void hmon_freerun(const int freerun);
+
+/**
+ * Check last update completion.
+ * @return 1 if every thread is done with the last update, else 0.
  **/
 int hmon_is_uptodate();
 
+/** Updates requested while threads are busy are dropped (default) **/
+#define HMON_MISS_DROP    0
+/** Updates requested while threads are busy wait for them. Periodic sampling fires missed deadlines back to back **/
+#define HMON_MISS_CATCHUP 1
+
+/**
+ * Choose what happens to updates requested while threads are still busy with the previous one.
+ * Dropping keeps the sampling rate bounded but leaves holes in traces. Catching up keeps one sample per period,
+ * at the cost of bursts after a stall.
+ * @param policy, HMON_MISS_DROP or HMON_MISS_CATCHUP.
+ **/
+void hmon_set_miss_policy(const int policy);
+
+/**
+ * @return The current miss policy.
+ **/
+int hmon_get_miss_policy();
+
+struct hmon_epoch_stats{
+  unsigned long epochs;       /* Number of epochs processed */
+  unsigned long skipped;      /* Number of updates dropped while threads were busy */
+  unsigned long late;         /* Number of epochs completed after the deadline */
+  long long     lateness_max; /* Maximum completion time past the deadline (nanoseconds) */
+};
+
+/**
+ * Set the time allowed to complete an epoch. Epochs completed later are accounted as late.
+ * hmon_sampling_start() sets the deadline to the sampling period.
+ * @param ns, the deadline in nanoseconds after the update request. 0 disables late epochs accounting.
+ **/
+void hmon_set_deadline(const long long ns);
+
+/**
+ * Spread cores updates across a time span instead of reading all cores at once after each update request.
+ * Each core is given a fixed offset in the span from its position in the topology, such that
+ * sockets, then caches, then cores below them, read in disjoint parts of the span.
+ * Samples timestamp is the actual time of their read.
+ * @param ns, the span in nanoseconds, usually a fraction of the update period. 0 reads all cores at once (default).
+ **/
+void hmon_set_stagger(const long long ns);
+
+/**
+ * Set the time budget of an epoch, beyond which monitors are shed.
+ * Each epoch over budget slows down the monitors of lowest PRIORITY one step (period x2, x4, x8), then pauses them,
+ * and then sheds the next priority. Monitors of the highest priority are never shed: monitors must have different
+ * priorities for shedding to happen. A warning is printed when registered monitors all share the same priority.
+ * Monitors are restored one step at a time, highest priority first, once epochs stay under half the budget.
+ * Shedding changes are written on stderr, and time shed per monitor in trace metadata.
+ * @param ns, the budget in nanoseconds. 0 disables load shedding (default).
+ **/
+void hmon_set_budget(const long long ns);
+
+/**
+ * Bound the CPU time used by hmon to a share of the machine, measured from its own phases timing (see hmon_self_times()).
+ * Every 16 epochs, a share above the maximum takes one more step: 1 update request out of 2, 4, 8 triggers an epoch,
+ * then monitors reduce 1 read out of 2, 4, 8, then monitors of lowest priority are shed like with hmon_set_budget().
+ * A share under half the maximum takes one step back. Each step is written as a comment line into traces.
+ * @param share, the maximum share of all PUs time, e.g. 0.01 for 1%. 0 disables the governor (default).
+ **/
+void hmon_set_max_overhead(const double share);
+
+/* Sampling threads placement policies */
+#define HMON_PLACE_CORE         0  /* Each core thread runs on the last PU of its core. Collectors share a core thread PU of their package */
+#define HMON_PLACE_HOUSEKEEPING 1  /* All threads of a package run on its last core, leaving other cores to the application */
+#define HMON_PLACE_OUTSIDE      2  /* Threads run on PUs out of a cpuset, preferably in their package */
+#define HMON_PLACE_NUMA         3  /* One collector per NUMA node reads the cores of the node */
+
+/**
+ * Choose where sampling threads run. Must be called before hmon_start().
+ * Except with HMON_PLACE_CORE, threads do not run on the cores they read: events counted on the reading CPU
+ * lose fidelity. HMON_PLACE_NUMA reads core monitors from collectors. Monitors whose eventset cannot be read from another
+ * cpu (without HMONITOR_EVENTSET_REMOTE) keep a thread on their core, and a diagnostic is printed.
+ * @param policy, one of HMON_PLACE_*. HMON_PLACE_CORE is the default.
+ * @param cpuset, for HMON_PLACE_OUTSIDE, the PUs where the application runs. If NULL, CPUs listed in
+ *        /sys/devices/system/cpu/isolated and /sys/devices/system/cpu/nohz_full are avoided. Unused by other policies.
+ * @return 0 on success, -1 if threads are started, the policy is unknown or no PU is left to run threads.
+ **/
+int hmon_set_placement(const int policy, hwloc_const_cpuset_t cpuset);
+
+/**
+ * Retrieve epoch accounting since library initialization.
+ * @param core, a core to get the statistics of its thread, a package or NUMA node for its collector, or NULL for global statistics.
+ *        Per core, skipped updates are those dropped while this core was still busy.
+ * @param stats, the structure to fill.
+ **/
+void hmon_epoch_stats(hwloc_obj_t core, struct hmon_epoch_stats * stats);
+
 /**
  * Import monitors from a configuration file. Imported monitors are stored in global list of monitors: monitors,
  * and also on topology node local lists of monitors.
@@ -88,17 +217,72 @@ int hmon_import_hmonitors(const char * input_path);
 
 /**
  * Update monitors every us micro seconds.
+ * Updates are triggered from a dedicated thread sleeping until absolute deadlines on CLOCK_MONOTONIC.
+ * Output of an update is printed while the next one is collected.
+ * With HMON_MISS_CATCHUP policy, deadlines missed during a long update are fired back to back.
  * @param us, the delay between each update.
  * @return -1 if an error occured, else 0.
  **/
 int hmon_sampling_start(const long us);
 
 /**
- * Stop monitors' sampling.
+ * Update monitors every ns nanoseconds, from a thread bound on pu busy-polling the clock.
+ * Core threads busy-wait on the epoch flag instead of sleeping, so that triggering reads needs no system call.
+ * This burns pu and the cores carrying monitors, and is meant for periods below 10us on a small set of monitors.
+ * Achieved periods are reported by hmon_sampling_stats(). Sampling is stopped with hmon_sampling_stop().
+ * Must be called after hmon_start().
+ * @param pu, the processing unit polling the clock. It must not run a core thread or a collector.
+ * @param ns, the delay between each update.
+ * @return -1 if an error occured or pu runs a library thread, else 0.
+ **/
+int hmon_busy_poll_start(hwloc_obj_t pu, const long long ns);
+
+/**
+ * Stop monitors' sampling, and print last update.
  * @return -1 if an error occured, else 0.
  **/
 int hmon_sampling_stop();
+
+/** Lateness histogram buckets: bucket 0 is below 1us, bucket i is [2^(i-1), 2^i[ us, last bucket is unbounded **/
+#define HMON_LATENESS_BUCKETS 16
+/** Achieved period histogram buckets: bucket 0 is below 2ns, bucket i is [2^i, 2^(i+1)[ ns, last bucket is unbounded **/
+#define HMON_PERIOD_BUCKETS 32
+
+struct hmon_sampling_stats{
+  unsigned long ticks;        /* Number of sampler ticks */
+  unsigned long overruns;     /* Number of deadlines skipped because a tick lasted more than the period */
+  long long     lateness_sum; /* Sum of ticks wake up lateness (nanoseconds) */
+  long long     lateness_max; /* Maximum tick wake up lateness (nanoseconds) */
+  unsigned long lateness_hist[HMON_LATENESS_BUCKETS]; /* Ticks wake up lateness histogram */
+  long long     period_min;   /* Minimum achieved period between two ticks (nanoseconds) */
+  long long     period_max;   /* Maximum achieved period between two ticks (nanoseconds) */
+  unsigned long period_hist[HMON_PERIOD_BUCKETS];     /* Achieved periods histogram */
+};
+
+/**
+ * Retrieve sampler timing statistics since last call to hmon_sampling_start().
+ * @param stats, the structure to fill.
+ **/
+void hmon_sampling_stats(struct hmon_sampling_stats * stats);
   
+/**
+ * Sampling engine phases timed for self-instrumentation.
+ * Stop, read, reduce and start are timed by core threads for all monitors they update.
+ * Wait is the time core threads spend sleeping between epochs. Output is the time spent printing monitors.
+ **/
+enum hmon_phase{HMON_PHASE_STOP, HMON_PHASE_READ, HMON_PHASE_REDUCE, HMON_PHASE_START, HMON_PHASE_OUTPUT, HMON_PHASE_WAIT, HMON_PHASE_COUNT};
+
+/**
+ * Retrieve the time spent by the engine in each phase, since library initialization.
+ * Phases of core threads are summed over the cores of location, or taken from the core above location.
+ * Cores read by a collector report the whole collector phases, shared with the other cores it reads.
+ * Output time is not bound to cores and is reported for every location.
+ * Self-instrumentation can be monitored with performance plugin hmon_self.
+ * @param location, the topology object to look at.
+ * @param times, the array to fill with cumulated nanoseconds, indexed by enum hmon_phase.
+ **/
+void hmon_self_times(hwloc_obj_t location, unsigned long long times[HMON_PHASE_COUNT]);
+
 /**
  * Display the monitors peridocally.
  * @arg display_monitors: the function used to display monitors.
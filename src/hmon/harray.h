@@ -21,6 +21,7 @@ void **        harray_get_data(harray harray);
 void *         harray_set          (harray, unsigned, void *);
 void *         harray_pop          (harray);
 void           harray_push         (harray, void *);
+void           harray_reserve      (harray, unsigned);
 void *         harray_remove       (harray, int);
 void           harray_insert       (harray, unsigned, void *);
 unsigned       harray_insert_sorted(harray array, void * element, int (* compare)(void*, void*));
@@ -2,6 +2,7 @@
 #define HMONITOR_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <hwloc.h>
 
@@ -13,46 +14,111 @@
  * It monitors the whole system.
  * @brief Struct to hold hardware events value.
  **/
+/* Cache line size. Monitors, their buffers, and their groups of fields written by different threads start on their own lines */
+#define HMON_CACHE_LINE 64
+
 typedef struct hmon{
-  /** identifier **/
-  char * id;
+  /****** Read-mostly state of the hot path, set when the monitor is created ******/
   /** node where values are recorded **/
   hwloc_obj_t location;
-  
-  /* monitor reference reset time */
-  long long ref_time;
-  
-  /** monitor input: eventsets, set of collected event. Last element of each line is the timestamp **/
-  void   * eventset;
-  double * events;
-  unsigned n_events;
-
-  /* The number of stored event updates, the index of latest update, and the total number of updates */
-  unsigned window, last, total;
-  
+
+  /** monitor input: eventsets, and a ring of the last reads stored by column: row r of event e is events[e*capacity+r].
+      Timestamps are stored apart in nanoseconds. Row is the last read as filled by the eventset, view a gathered older row **/
+  void    * eventset;
+  double  * events;
+  int64_t * timestamps;
+  double  * row, * view;
+  unsigned  n_events;
+  /* Global epoch of each stored events row */
+  int * epochs;
+
+  /* The number of reads reduced, and the ring rows (a power of two not less than window) */
+  unsigned window, capacity;
+
+  /* Adaptive period bounds. The period is adapted to samples variations when period_max > period_min */
+  unsigned period_min, period_max;
+
+  /* Under overload, monitors of lowest priority are shed first */
+  int priority;
+
   /** monitor output: events reduction **/
-  char ** labels;
-  double * samples, * max, * min;
+  double * samples, * max, * min, * previous;
   unsigned n_samples;
   void (* model)(struct hmon*);
-    
+  /** heavy reductions are run by a worker pool on a copy of the window. Samples are published at the next read. **/
+  int heavy;
+  void * offload;
+
+  /** Free-running monitors are not stopped around reads. Cumulative eventsets then store the difference with previous raw values **/
+  int freerun, cumulative;
+  double * raw;
+
+  /** The eventset can be read from any cpu. Then cores carrying only such monitors are read by a collector instead of their own thread **/
+  int remote;
+
   /** pointers to performance library handling event collection. Functions documentation in plugins/performance_plugin.h  **/
   int (* eventset_start)   (void *);
   int (* eventset_stop)    (void *);
   int (* eventset_reset)   (void *);
   int (* eventset_read)    (void *, double *);
   int (* eventset_destroy) (void *);
+  int (* eventset_epoch)   (void *);
+
+  /** Integer eventsets (plugins with hmonitor_eventset_read_u64) also keep exact counts: columns laid out as events,
+      the last read row, and previous raw values of free-running monitors. NULL for other eventsets **/
+  int (* eventset_read_u64)(void *, uint64_t *);
+  uint64_t * counts, * count_row, * raw_counts;
+
+  /****** Written by the thread reading the monitor ******/
+  /** Handle concurrent updates **/
+  pthread_t owner __attribute__((aligned(HMON_CACHE_LINE)));
+  pthread_mutex_t mutex;
+  /** If stopped do not stop twice **/
+  int stopped;
+
+  /* The ring row of latest read, and the total number of reads */
+  unsigned last, total;
+
+  /* Sampling period in number of sampling epochs, adapted after reads, and epoch of the last read */
+  unsigned period;
+  int epoch;
+
+  /* monitor reference reset time */
+  long long ref_time;
+  /* Time spent in eventset_read (nanoseconds) since last reset */
+  unsigned long long read_time;
+  /* Epoch of the events row samples were reduced from */
+  int samples_epoch;
+  /* Number of reads where some children samples were from an older epoch than the monitor read */
+  unsigned long stale;
+
+  /****** Written by the thread triggering updates. Set by synchronize.c ******/
+  /* Next epoch where the monitor is due, and last epoch where it was due */
+  int next __attribute__((aligned(HMON_CACHE_LINE)));
+  int due;
+
+  /* Shed steps: the period is multiplied by 2^shed, or the monitor is paused.
+     Time when shedding started, and total time shed (nanoseconds) */
+  unsigned shed;
+  long long shed_start;
+  unsigned long long shed_time;
+
+  /** copy of samples and their timestamp, taken when an update completed, and printed while next update is running **/
+  double * snapshot;
+  int64_t snapshot_time, output_time;
+  int snapshot_epoch;
+  unsigned snapshot_period;
+
+  /****** Cold metadata ******/
+  /** identifier and labels, interned: shared by monitors with the same names **/
+  char * id __attribute__((aligned(HMON_CACHE_LINE)));
+  char ** labels;
 
   /** Output file. This is private, set and destroyed by synchronize.c **/
   FILE * output;
 
   /** Do we display this one on topology **/
   unsigned display;
-  /** If smaketopped do not stop twice **/
-  int stopped;
-  /** Handle concurrent updates **/
-  pthread_t owner;
-  pthread_mutex_t mutex;
 
   /* Set to NULL, unused by the library, but maybe by some plugins */
   void * userdata;
@@ -77,7 +143,7 @@ hmon new_hmonitor(const char * id, hwloc_obj_t location, const char ** event_nam
 		  const char* perf_plugin, const char* model_plugin, FILE* output);
 
 /**
- * Delete a monitor
+ * Delete a monitor. Its memory is released with the library, in hmon_lib_finalize().
  * @param m: The monitor to delete.
  **/
 void delete_hmonitor(hmon m);
@@ -107,6 +173,7 @@ int hmonitor_stop(hmon m);
 
 /**
  * Update monitor timestamp and input events...
+ * If the monitor is free-running and its eventset cumulative, the difference with previous read is stored.
  * If the monitor is concurrent, the call may succceed only if monitor is released, or the calling thread is the same that 
  * acquired this monitor lock.
  * @param m: The monitor to update.
@@ -118,7 +185,8 @@ int hmonitor_read(hmon m);
  * Call monitor reduction function and update maximum and minimum value of each output event.
  * The call may succceed only if the calling thread owns the monitor.
  * @param m: The monitor to reduce.
- * @return 0 if the call does not come from the owner thread, 1 if reduction succeeded.
+ * @return 0 if the call does not come from the owner thread, 1 if reduction succeeded,
+ * 2 if a heavy reduction was queued while no new samples were published.
  **/
 int hmonitor_reduce(hmon m);
 
@@ -129,7 +197,14 @@ int hmonitor_reduce(hmon m);
 void hmonitor_output_header(hmon m);
 
 /**
- * Print monitor to file.
+ * Copy monitor samples and timestamp of the last update, for later output.
+ * The call must not overlap with a monitor update.
+ * @param m: the monitor to snapshot.
+ **/
+void hmonitor_snapshot(hmon m);
+
+/**
+ * Print monitor last snapshot to file, if it was not printed yet.
  * The monitor will only be print if its field output was manually set, and the call is made form the thread creating the monitor, or the flag force is set to 1.
  * @param m: the monitor to print.
  * @param force: if true print anyway.
@@ -154,29 +229,67 @@ int hmonitor_trylock(hmon m, int wait);
 int hmonitor_release(hmon m);
 
 /**
- * Get the events of a previous read stored into the monitor.
+ * Get the events of a previous read stored into the monitor, as a contiguous row.
+ * The row of the last read (i = m->last) is the one filled by the eventset. Older rows are gathered from columns into
+ * a buffer of the monitor, overwritten by the next call: only the monitor owner should read them.
  * @param m: The monitor which events are to be retrieved.
- * @param i: The index/oldness of the events. Must be less than m->window.
- * @return The ith events collected from now. 
+ * @param i: The ring row of the read. Must be less than m->capacity.
+ * @return The events of ring row i.
  **/
 double * hmonitor_get_events(hmon m, unsigned i);
 
 /**
  * Get the ith event of one of previously read events.
  * @param m: The monitor which event value is to be retrieved.
- * @param row: the index of the previous read of events from now. Must be less than m->window.
+ * @param row: the ring row of the read. Must be less than m->capacity.
  * @param event: The event index among row events.
  * @return An event value.
  **/
 double   hmonitor_get_event(hmon m, unsigned row, unsigned event);
 
+/**
+ * Get the values of an event in every ring row, contiguous. Rows of the window are given by hmonitor_get_window().
+ * @param m: The monitor which event values are to be retrieved.
+ * @param event: The event index.
+ * @return An array of m->capacity values indexed by ring row.
+ **/
+double * hmonitor_get_column(hmon m, unsigned event);
+
+/**
+ * Get the exact counts of an event in every ring row, for monitors of integer eventsets.
+ * Events columns hold the same values converted to double. Heavy reductions only see the latter.
+ * @param m: The monitor which counts are to be retrieved.
+ * @param event: The event index.
+ * @return An array of m->capacity counts indexed by ring row, or NULL if the eventset is not integer.
+ **/
+uint64_t * hmonitor_get_counts(hmon m, unsigned event);
+
+/**
+ * Get the ring rows of the last reads in window, as two contiguous ranges: the ring wraps at m->capacity.
+ * The last n reads are rows [first, first+n1) then rows [0, n-n1), oldest first.
+ * @param m: The monitor.
+ * @param first: Set to the ring row of the oldest read in window.
+ * @param n1: Set to the number of rows of the first range.
+ * @return n, the number of reads in window: the minimum of m->window and m->total.
+ **/
+unsigned hmonitor_get_window(hmon m, unsigned * first, unsigned * n1);
+
 /**
  * Get the monitor timestamp of a previously collected set of events.
  * @param m: The monitor from which a timestamp is to be retrieved.
- * @param i: The index/oldness of the timestamp. Must be less than m->window.
+ * @param i: The ring row of the read. Must be less than m->capacity.
  * @return A timestamp in nanoseconds since the previous resset.
  **/
-long hmonitor_get_timestamp(hmon m, unsigned i);
+int64_t hmonitor_get_timestamp(hmon m, unsigned i);
+
+/**
+ * Get the global epoch of a previously collected set of events.
+ * Monitors rows of the same epoch, at any depth, were read during the same hmon_update().
+ * @param m: The monitor from which an epoch is to be retrieved.
+ * @param i: The ring row of the read. Must be less than m->capacity.
+ * @return The epoch id.
+ **/
+int hmonitor_get_epoch(hmon m, unsigned i);
 
 
 /**
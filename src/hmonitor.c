@@ -1,9 +1,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <float.h>
+#include <inttypes.h>
 #include <time.h>
 #include "./internal.h"
-#include "./hmon/hmonitor.h"
+#include "./hmon.h"
+#include "./plugins/performance_plugin.h"
 
 static void print_avail_events(struct hmon_plugin * lib){
   char ** (* events_list)(int *) = hmon_plugin_load_fun(lib, "hmonitor_events_list", 1);
@@ -20,26 +22,70 @@ static void print_avail_events(struct hmon_plugin * lib){
   free(avail);
 }
 
-static void hmonitor_set_timestamp(hmon m, long timestamp){
-  m->events[m->last*(m->n_events+1)+m->n_events] = timestamp;
+static void hmonitor_set_timestamp(hmon m, int64_t timestamp){
+  m->timestamps[m->last] = timestamp;
 }
 
+/* Labels are interned: instances of a monitor at different locations share them */
 static void hmonitor_set_labels(hmon m, const char ** labels, const unsigned n){
   unsigned i;
-  m->labels = malloc(sizeof(*m->labels) * m->n_samples);
+  char label[16];
   for(i=0; i<n && i<m->n_samples; i++)
-    m->labels[i] = strdup(labels[i]);
+    m->labels[i] = (char*)hmon_intern(labels[i]);
   for(; i<m->n_samples; i++){
-    m->labels[i] = malloc(16); memset(m->labels[i], 0, 16);
-    snprintf(m->labels[i], 16, "V%u", i);
+    snprintf(label, sizeof(label), "V%u", i);
+    m->labels[i] = (char*)hmon_intern(label);
   }
 }
 
+/* Carve monitor buffers from one block of the arena of its location NUMA nodes. Each buffer starts a cache line */
+static void hmonitor_alloc_buffers(hmon m){
+  size_t rows = m->capacity, n = m->n_events, s = m->n_samples;
+  size_t size = HMON_LINES(sizeof(double)*rows*n) + HMON_LINES(sizeof(int64_t)*rows) + HMON_LINES(sizeof(int)*rows) +
+    3*HMON_LINES(sizeof(double)*n) + 5*HMON_LINES(sizeof(double)*s) + HMON_LINES(sizeof(char*)*s);
+  if(m->eventset_read_u64 != NULL){size += HMON_LINES(sizeof(uint64_t)*rows*n) + 2*HMON_LINES(sizeof(uint64_t)*n);}
+  char * block = hmon_arena_alloc(m->location->nodeset, size);
+
+  m->events     = (double*)block;  block += HMON_LINES(sizeof(double)*rows*n);
+  m->timestamps = (int64_t*)block; block += HMON_LINES(sizeof(int64_t)*rows);
+  m->epochs     = (int*)block;     block += HMON_LINES(sizeof(int)*rows);
+  m->row        = (double*)block;  block += HMON_LINES(sizeof(double)*n);
+  m->view       = (double*)block;  block += HMON_LINES(sizeof(double)*n);
+  m->raw        = (double*)block;  block += HMON_LINES(sizeof(double)*n);
+  m->samples    = (double*)block;  block += HMON_LINES(sizeof(double)*s);
+  m->max        = (double*)block;  block += HMON_LINES(sizeof(double)*s);
+  m->min        = (double*)block;  block += HMON_LINES(sizeof(double)*s);
+  m->snapshot   = (double*)block;  block += HMON_LINES(sizeof(double)*s);
+  m->previous   = (double*)block;  block += HMON_LINES(sizeof(double)*s);
+  m->labels     = (char**)block;   block += HMON_LINES(sizeof(char*)*s);
+  if(m->eventset_read_u64 != NULL){
+    m->counts     = (uint64_t*)block; block += HMON_LINES(sizeof(uint64_t)*rows*n);
+    m->count_row  = (uint64_t*)block; block += HMON_LINES(sizeof(uint64_t)*n);
+    m->raw_counts = (uint64_t*)block;
+  } else {
+    m->counts = m->count_row = m->raw_counts = NULL;
+  }
+}
+
+/* Bind memory allocated by the calling thread to the NUMA nodes of location. Previous binding is saved into saved and policy */
+static int hmonitor_membind(hwloc_obj_t location, hwloc_nodeset_t saved, hwloc_membind_policy_t * policy){
+  const int flags = HWLOC_MEMBIND_THREAD | HWLOC_MEMBIND_BYNODESET;
+  return location->nodeset != NULL &&
+    hwloc_get_membind(hmon_topology, saved, policy, flags) == 0 &&
+    hwloc_set_membind(hmon_topology, location->nodeset, HWLOC_MEMBIND_BIND, flags) == 0;
+}
+
+static void hmonitor_membind_restore(int bound, hwloc_nodeset_t saved, hwloc_membind_policy_t policy){
+  if(bound){hwloc_set_membind(hmon_topology, saved, policy, HWLOC_MEMBIND_THREAD | HWLOC_MEMBIND_BYNODESET);}
+  hwloc_bitmap_free(saved);
+}
+
 void hmonitor_output_header(hmon m){
   unsigned i;
   char str[32]; memset(str, 0, sizeof(str));
   snprintf(str, sizeof(str), "%8s:%u", hwloc_type_name(m->location->type), m->location->logical_index);
-  fprintf(m->output,"%*s %14s ", (int)strlen(str), "Obj", "Nanoseconds");
+  fprintf(m->output,"%*s %14s %8s ", (int)strlen(str), "Obj", "Nanoseconds", "Epoch");
+  if(m->period_max > m->period_min){fprintf(m->output,"%8s ", "Period");}
   memset(str, 0, sizeof(str));
   snprintf(str, sizeof(str), "%-.6e", 0.0);
   for(i=0; i<m->n_samples; i++) fprintf(m->output,"%*s ", (int)strlen(str), m->labels[i]);
@@ -66,13 +112,26 @@ new_hmonitor(const char *id, const hwloc_obj_t location, const char ** event_nam
 {
   if(window == 0 || id == NULL || location == NULL || perf_plugin == NULL){return NULL;}
 
-  hmon monitor = malloc(sizeof(*monitor));
+  /* Monitors are never freed alone: their memory is released with their arena */
+  hmon monitor = hmon_arena_alloc(location->nodeset, sizeof(*monitor));
         
   /* Set default attributes */
-  monitor->id = strdup(id);
+  monitor->id = (char*)hmon_intern(id);
   monitor->location = location;
   monitor->window = window;
+  /* Ring rows wrap with a mask */
+  for(monitor->capacity = 1; monitor->capacity < window; monitor->capacity <<= 1);
+  monitor->period = 1;
+  monitor->period_min = monitor->period_max = 1;
+  monitor->next = monitor->due = monitor->epoch = 0;
   monitor->userdata = NULL;
+  monitor->freerun = 0;
+  monitor->heavy = 0;
+  monitor->offload = NULL;
+  monitor->priority = 0;
+  monitor->shed = 0;
+  monitor->shed_start = 0;
+  monitor->shed_time = 0;
   monitor->display = 0;
   monitor->owner = pthread_self();
   monitor->output = output;
@@ -90,6 +149,8 @@ new_hmonitor(const char *id, const hwloc_obj_t location, const char ** event_nam
   monitor->eventset_reset    = hmon_plugin_load_fun(plugin, "hmonitor_eventset_reset",   1);
   monitor->eventset_read     = hmon_plugin_load_fun(plugin, "hmonitor_eventset_read",    1);
   monitor->eventset_destroy  = hmon_plugin_load_fun(plugin, "hmonitor_eventset_destroy", 1);
+  monitor->eventset_epoch    = hmon_plugin_load_fun(plugin, "hmonitor_eventset_epoch",   0);
+  monitor->eventset_read_u64 = hmon_plugin_load_fun(plugin, "hmonitor_eventset_read_u64", 0);
   if(monitor->eventset_start   == NULL ||
      monitor->eventset_stop    == NULL ||
      monitor->eventset_reset   == NULL ||
@@ -107,13 +168,18 @@ new_hmonitor(const char *id, const hwloc_obj_t location, const char ** event_nam
   int (* eventset_init)(void **, hwloc_obj_t);
   int (* eventset_init_fini)(void*);
   int (* add_named_event)(void*, const char*);
+  int (* eventset_flags)(void*);
   eventset_init      = hmon_plugin_load_fun(plugin, "hmonitor_eventset_init"           , 1);
   eventset_init_fini = hmon_plugin_load_fun(plugin, "hmonitor_eventset_init_fini"      , 1);
   add_named_event    = hmon_plugin_load_fun(plugin, "hmonitor_eventset_add_named_event", 1);
 
+  /* Plugin eventset state is allocated while memory is bound to location. Only pages faulted meanwhile are placed there */
+  hwloc_nodeset_t saved = hwloc_bitmap_alloc();
+  hwloc_membind_policy_t policy;
+  int bound = hmonitor_membind(location, saved, &policy);
   if(eventset_init(&monitor->eventset, location)){
     monitor_print_err("%s failed to initialize eventset\n", id);
-    free(monitor);
+    hmonitor_membind_restore(bound, saved, policy);
     return NULL;
   }
   for(i=0; i<n_events; i++){
@@ -121,29 +187,28 @@ new_hmonitor(const char *id, const hwloc_obj_t location, const char ** event_nam
     if(err == -1){
       monitor_print_err("failed to add event %s to %s eventset\n", event_names[i], id);
       print_avail_events(plugin);
-      free(monitor);
+      hmonitor_membind_restore(bound, saved, policy);
       return NULL;
     }
     added_events += err;
   }
   eventset_init_fini(monitor->eventset);
-  monitor->events = malloc(window*(added_events+1)*sizeof(double));
+  hmonitor_membind_restore(bound, saved, policy);
   monitor->n_events = added_events;
+  eventset_flags = hmon_plugin_load_fun(plugin, "hmonitor_eventset_flags", 0);
+  monitor->cumulative = eventset_flags != NULL && (eventset_flags(monitor->eventset) & HMONITOR_EVENTSET_CUMULATIVE);
+  monitor->remote = eventset_flags != NULL && (eventset_flags(monitor->eventset) & HMONITOR_EVENTSET_REMOTE);
   
   /* Initialize output */  
   if(model_plugin){
-    monitor->samples = malloc(sizeof(double) * n_samples+1);
-    monitor->max = malloc(sizeof(double) * n_samples+1);
-    monitor->min = malloc(sizeof(double) * n_samples+1);	
     monitor->n_samples = n_samples;
     monitor->model = hmon_stat_plugins_lookup_function(model_plugin);
+    hmonitor_alloc_buffers(monitor);
     hmonitor_set_labels(monitor, labels, labels == NULL ? 0 : n_samples);
   } else {
-    monitor->samples = malloc(sizeof(double) * added_events+1);
-    monitor->max = malloc(sizeof(double) * added_events+1);
-    monitor->min = malloc(sizeof(double) * added_events+1);
     monitor->n_samples = added_events;
     monitor->model = NULL;
+    hmonitor_alloc_buffers(monitor);
     if(labels == NULL && added_events > n_events){
       hmonitor_set_labels(monitor, NULL, 0);
     } else if(labels == NULL){
@@ -151,7 +216,6 @@ new_hmonitor(const char *id, const hwloc_obj_t location, const char ** event_nam
     } else {
       hmonitor_set_labels(monitor, labels, n_samples);
     }
-    monitor->n_samples = added_events;
   }
   
   /* reset values */
@@ -163,69 +227,112 @@ new_hmonitor(const char *id, const hwloc_obj_t location, const char ** event_nam
 }
 
 void delete_hmonitor(hmon monitor){
-  int i;
   hmonitor_stop(monitor);
-  free(monitor->events);
-  free(monitor->samples);
-  free(monitor->max);
-  free(monitor->min);
-  free(monitor->id);
+  hmon_offload_detach(monitor);
   monitor->eventset_destroy(monitor->eventset);
-  for(i=0; i<monitor->n_samples; i++){free(monitor->labels[i]);}
-  free(monitor->labels);
   pthread_mutex_destroy(&(monitor->mutex));
-  free(monitor);
 }
 
 void hmonitor_reset(hmon m){
   unsigned i;
-  m->last = 0;
   m->total = 0;
-  m->last = m->window-1;
+  m->last = m->capacity-1;
   m->stopped = 1;
-  for(i=0;i<m->window*m->n_events+1;i++){m->events[i] = 0;}
+  m->read_time = 0;
+  m->samples_epoch = m->snapshot_epoch = 0;
+  m->stale = 0;
+  for(i=0;i<m->capacity*m->n_events;i++){m->events[i] = 0;}
+  for(i=0;i<m->capacity;i++){m->timestamps[i] = 0; m->epochs[i] = 0;}
+  for(i=0;i<m->n_events;i++){m->raw[i] = m->row[i] = m->view[i] = 0;}
+  if(m->counts != NULL){
+    for(i=0;i<m->capacity*m->n_events;i++){m->counts[i] = 0;}
+    for(i=0;i<m->n_events;i++){m->raw_counts[i] = m->count_row[i] = 0;}
+  }
   for(i=0;i<m->n_samples;i++){
     m->samples[i]=0;
     m->max[i]=DBL_MIN;
     m->min[i]=DBL_MAX;
+    m->snapshot[i]=0;
+    m->previous[i]=0;
   }
+  m->snapshot_time = m->output_time = -1;
   m->eventset_reset(m->eventset);
   struct timespec tp;
   clock_gettime(CLOCK_MONOTONIC, &tp);
   m->ref_time = 1000000000 * tp.tv_sec + tp.tv_nsec;
 }
 
+void hmonitor_snapshot(hmon m){
+  if(m->output == NULL){return;}
+  memcpy(m->snapshot, m->samples, sizeof(double)*(m->n_samples));
+  m->snapshot_time = m->total ? hmonitor_get_timestamp(m,m->last) : -1;
+  m->snapshot_epoch = m->samples_epoch;
+  m->snapshot_period = m->period;
+}
+
 void hmonitor_output(hmon m, const int force){
-  if(m->output != NULL && (m->owner == pthread_self() || force)){
+  if(m->output != NULL && m->snapshot_time > m->output_time && (m->owner == pthread_self() || force)){
     unsigned j;
     char samples[m->n_samples*20]; memset(samples, 0, sizeof(samples));
     char *c = samples;
-    for(j=0;j<m->n_samples;j++){c+=sprintf(c, "%-.6e ", m->samples[j]);}
-    fprintf(m->output,"%8s:%u %14ld %s\n",
+    for(j=0;j<m->n_samples;j++){c+=sprintf(c, "%-.6e ", m->snapshot[j]);}
+    fprintf(m->output,"%8s:%u %14" PRId64 " %8d ",
 	    hwloc_type_name(m->location->type),
 	    m->location->logical_index,
-	    hmonitor_get_timestamp(m,m->last),
-	    samples);
+	    m->snapshot_time,
+	    m->snapshot_epoch);
+    /* Adaptive monitors record their effective period */
+    if(m->period_max > m->period_min){fprintf(m->output,"%8u ", m->snapshot_period);}
+    fprintf(m->output,"%s\n", samples);
     fflush(m->output);
+    m->output_time = m->snapshot_time;
   }
 }
 
 double * hmonitor_get_events(hmon m, unsigned i){
-  return &(m->events[i*(m->n_events+1)]);
+  unsigned e;
+  if(i == m->last){return m->row;}
+  for(e=0; e<m->n_events; e++){m->view[e] = m->events[e*m->capacity+i];}
+  return m->view;
 }
 
 double hmonitor_get_event(hmon m, unsigned row, unsigned event){
-  return m->events[row*(m->n_events+1)+event];
+  return m->events[event*m->capacity+row];
 }
 
-long hmonitor_get_timestamp(hmon m, unsigned i){
-  return (long)m->events[i*(m->n_events+1)+m->n_events];
+double * hmonitor_get_column(hmon m, unsigned event){
+  return &(m->events[event*m->capacity]);
+}
+
+uint64_t * hmonitor_get_counts(hmon m, unsigned event){
+  return m->counts == NULL ? NULL : &(m->counts[event*m->capacity]);
+}
+
+unsigned hmonitor_get_window(hmon m, unsigned * first, unsigned * n1){
+  unsigned n = m->total < m->window ? m->total : m->window;
+  *first = (m->last + 1 + m->capacity - n) & (m->capacity - 1);
+  *n1 = m->capacity - *first < n ? m->capacity - *first : n;
+  return n;
+}
+
+int64_t hmonitor_get_timestamp(hmon m, unsigned i){
+  return m->timestamps[i];
+}
+
+int hmonitor_get_epoch(hmon m, unsigned i){
+  return m->epochs[i];
 }
 
 int hmonitor_start(hmon m){
+  unsigned i;
   if(!m->stopped){return 1;}
   if(m->owner == pthread_self()){
     if(m->eventset_start(m->eventset) == -1){return -1;}
+    /* Counters restart from 0 */
+    for(i=0;i<m->n_events;i++){
+      m->raw[i] = 0;
+      if(m->counts != NULL){m->raw_counts[i] = 0;}
+    }
     m->stopped = 0;
     if(pthread_mutex_unlock(&m->mutex) != 0){perror("pthread_mutex_unlock"); return -1;}
     return 1;
@@ -269,18 +376,53 @@ int hmonitor_release(hmon m){
 int hmonitor_read(hmon m){
   /* Only if caller took the lock, or we don't care about concurrent calls or we can acquire the lock and become owner */  
   if(m->owner == pthread_self()){
-    m->last = (m->last+1)%(m->window);
+    m->last = (m->last+1) & (m->capacity-1);
     m->total = m->total+1;
     /* Save timestamp */
     struct timespec tp;
     clock_gettime(CLOCK_MONOTONIC, &tp);
     hmonitor_set_timestamp(m, 1000000000 * tp.tv_sec + tp.tv_nsec - m->ref_time);
-    /* Read events */
-    if((m->eventset_read(m->eventset, hmonitor_get_events(m, m->last))) == -1){
+    m->epochs[m->last] = m->due;
+    /* Read events, as exact counts from integer eventsets */
+    int err = m->counts != NULL ? m->eventset_read_u64(m->eventset, m->count_row) : m->eventset_read(m->eventset, m->row);
+    if(err == -1){
       fprintf(stderr, "Failed to read counters from monitor on obj %s:%d\n",
 	      hwloc_type_name(m->location->type), m->location->logical_index);
       return -1;
     }
+    /* Monitors reading other monitors report the oldest epoch they read */
+    if(m->eventset_epoch != NULL && m->eventset_epoch(m->eventset) < m->due){m->stale++;}
+    struct timespec tr;
+    clock_gettime(CLOCK_MONOTONIC, &tr);
+    m->read_time += 1000000000 * (tr.tv_sec - tp.tv_sec) + tr.tv_nsec - tp.tv_nsec;
+    unsigned i;
+    if(m->counts != NULL){
+      /* Running counters: keep the difference with previous read, exact */
+      if(m->freerun && m->cumulative){
+	for(i=0;i<m->n_events;i++){
+	  uint64_t v = m->count_row[i];
+	  m->count_row[i] = v - m->raw_counts[i];
+	  m->raw_counts[i] = v;
+	}
+      }
+      /* Store the row into columns, exact and converted to double for reductions and outputs */
+      for(i=0;i<m->n_events;i++){
+	m->counts[i*m->capacity+m->last] = m->count_row[i];
+	m->row[i] = m->events[i*m->capacity+m->last] = (double)m->count_row[i];
+      }
+    } else {
+      /* Running counters: keep the difference with previous read */
+      if(m->freerun && m->cumulative){
+	for(i=0;i<m->n_events;i++){
+	  double v = m->row[i];
+	  m->row[i] = v - m->raw[i];
+	  m->raw[i] = v;
+	}
+      }
+      /* Store the row into columns */
+      for(i=0;i<m->n_events;i++){m->events[i*m->capacity+m->last] = m->row[i];}
+    }
+    m->epoch = m->due;
     return 1;
   }
   return 0;
@@ -290,8 +432,9 @@ int hmonitor_reduce(hmon m){
   unsigned i;
   if(m->owner == pthread_self()){
     /* Reduce events */
-    if(m->model!=NULL){m->model(m);}
-    else{memcpy(m->samples, hmonitor_get_events(m, m->last), sizeof(double)*(m->n_samples));}
+    if(m->offload!=NULL){if(!hmon_offload_reduce(m)){return 2;}}
+    else if(m->model!=NULL){m->model(m); m->samples_epoch = m->epochs[m->last];}
+    else{memcpy(m->samples, hmonitor_get_events(m, m->last), sizeof(double)*(m->n_samples)); m->samples_epoch = m->epochs[m->last];}
     for(i=0;i<m->n_samples;i++){
       m->max[i] = (m->max[i] > m->samples[i]) ? m->max[i] : m->samples[i];
       m->min[i] = (m->min[i] < m->samples[i]) ? m->min[i] : m->samples[i];
@@ -14,7 +14,7 @@ int hwloc_check_version_mismatch(){
   return 0;
 }
 
-static int chk_cpu_bind(hwloc_topology_t topology, hwloc_cpuset_t cpuset, int print)
+static int chk_cpu_bind(hwloc_topology_t topology, hwloc_const_cpuset_t cpuset, int print)
 {
     hwloc_bitmap_t checkset = hwloc_bitmap_alloc();
     if(hwloc_get_cpubind(topology, checkset, HWLOC_CPUBIND_THREAD) == -1){
@@ -112,13 +112,18 @@ hwloc_obj_t location_parse(hwloc_topology_t topology, const char* location){
     return hwloc_get_obj_by_depth(topology,depth,logical_index);
 }
 
-int location_cpubind(hwloc_topology_t topology, hwloc_obj_t location)
+int cpuset_cpubind(hwloc_topology_t topology, hwloc_const_cpuset_t cpuset)
 {
-    if(hwloc_set_cpubind(topology,location->cpuset, HWLOC_CPUBIND_THREAD|HWLOC_CPUBIND_STRICT|HWLOC_CPUBIND_NOMEMBIND) == -1){
+    if(hwloc_set_cpubind(topology,cpuset, HWLOC_CPUBIND_THREAD|HWLOC_CPUBIND_STRICT|HWLOC_CPUBIND_NOMEMBIND) == -1){
 	perror("cpubind");
 	return -1;
     }
-    return chk_cpu_bind(topology, location->cpuset,0);
+    return chk_cpu_bind(topology, cpuset,0);
+}
+
+int location_cpubind(hwloc_topology_t topology, hwloc_obj_t location)
+{
+    return cpuset_cpubind(topology, location->cpuset);
 }
 
 int location_membind(hwloc_topology_t topology, hwloc_obj_t location)
@@ -1,12 +1,14 @@
 #ifndef MONITOR_UTILS_H
 #define MONITOR_UTILS_H
 
+#include <pthread.h>
 #include <hwloc.h>
 
 /*********************************************** hwloc utils ***************************************************/
 
 int          hwloc_check_version_mismatch();
 int          location_cpubind(hwloc_topology_t, hwloc_obj_t);
+int          cpuset_cpubind(hwloc_topology_t, hwloc_const_cpuset_t);
 int          location_membind(hwloc_topology_t, hwloc_obj_t);
 char *       location_name   (hwloc_obj_t);
 hwloc_obj_t  location_parse  (hwloc_topology_t, const char *);
@@ -46,12 +48,47 @@ void                    hmon_stat_plugins_list();
 void                    hmon_perf_plugins_list();
 void *                  hmon_stat_plugins_lookup_function(const char * name);
 
+/********************************************* offload utils ***************************************************/
+
+/* Heavy reductions run in a pool of unbound workers on a copy of the monitor window */
+struct hmon;
+void hmon_offload_attach  (struct hmon *);
+void hmon_offload_detach  (struct hmon *);
+void hmon_offload_reserve (unsigned n);    /* Size workers deques for n reductions */
+int  hmon_offload_reduce  (struct hmon *); /* Queue a reduction. Return 1 if previous one was published into samples */
+void hmon_offload_finalize();
+
+/********************************************* thread utils ****************************************************/
+
+/* Initialize attributes of library threads, with real-time scheduling if enabled in hmon_lib_init() */
+void hmon_thread_attr_init(pthread_attr_t * attr);
+/* Make library threads busy-wait for epochs instead of sleeping */
+void hmon_spin(const int enable);
+/* Return 1 if a core thread or collector may run on cpuset, 0 if none, -1 if threads are not started yet */
+int  hmon_threads_on(hwloc_const_cpuset_t cpuset);
+
+#if defined(__x86_64__) || defined(__i386__)
+#define hmon_cpu_relax() __builtin_ia32_pause()
+#else
+#define hmon_cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
+
+/********************************************** arena utils ****************************************************/
+
+/* Monitor state lives in per NUMA nodes arenas, released at once by hmon_lib_finalize() */
+void *       hmon_arena_alloc   (hwloc_const_nodeset_t, size_t); /* Whole cache lines bound to nodeset. NULL nodeset is not bound */
+const char * hmon_intern        (const char *);                  /* Shared copy of a string, valid until finalization */
+void         hmon_arena_finalize();
+
 /*********************************************** misc utils ****************************************************/
 
 int hmon_compare(void* hmonitor_a, void* hmonitor_b);
 #define perror_EXIT(msg) do{perror(msg); exit(EXIT_FAILURE);} while(0)
 #define malloc_chk(ptr, size) do{ptr = malloc(size); if(ptr == NULL){perror_EXIT("malloc");}} while(0)
 #define realloc_chk(ptr, size) do{if((ptr = realloc(ptr,size)) == NULL){perror_EXIT("realloc");}} while(0)
+/* Allocate whole cache lines (HMON_CACHE_LINE in hmonitor.h): buffers written by different threads never share a line */
+#define HMON_LINES(size) (((size)/HMON_CACHE_LINE+1)*HMON_CACHE_LINE)
+#define malloc_lines_chk(ptr, size) do{if(posix_memalign((void**)&(ptr), HMON_CACHE_LINE, HMON_LINES(size)) != 0){perror_EXIT("posix_memalign");}} while(0)
 #define MAX(a,b) ((a)>(b) ? (a) : (b))
 #define MIN(a,b) ((a)<(b) ? (a) : (b))
 #define str(s) #s
@@ -103,6 +103,78 @@ static struct perf_option display_opt = {.name = "--display-topology",
 					 .def_val = "0",
 					 .set = 0};
 
+static struct perf_option freerun_opt = {.name = "--free-running",
+					 .short_name = "-F",
+					 .arg = "",
+					 .desc = "Do not stop counters around reads. Cumulative counters output differences between reads.",
+					 .type = OPT_TYPE_BOOL,
+					 .value.int_value = 0,
+					 .def_val = "0",
+					 .set = 0};
+
+static struct perf_option catchup_opt = {.name = "--catch-up",
+					 .short_name = "-c",
+					 .arg = "",
+					 .desc = "Delay updates requested while monitors are busy instead of dropping them.",
+					 .type = OPT_TYPE_BOOL,
+					 .value.int_value = 0,
+					 .def_val = "0",
+					 .set = 0};
+
+static struct perf_option realtime_opt = {.name = "--realtime",
+					  .short_name = "-R",
+					  .arg = "<priority>",
+					  .desc = "Sample with SCHED_FIFO threads at priority, and locked memory. Print sampler jitter at exit.",
+					  .type = OPT_TYPE_INT,
+					  .value.int_value = 0,
+					  .def_val = "0",
+					  .set = 0};
+
+static struct perf_option busy_opt =    {.name = "--busy-poll",
+					 .short_name = "-b",
+					 .arg = "<PU:index>",
+					 .desc = "Busy-poll the clock on a PU to update monitors every -f microseconds. Core threads spin. Print achieved periods at exit.",
+					 .type = OPT_TYPE_STRING,
+					 .value.str_value = NULL,
+					 .def_val = "NULL",
+					 .set = 0};
+
+static struct perf_option stagger_opt = {.name = "--stagger",
+					 .short_name = "-s",
+					 .arg = "<percent>",
+					 .desc = "Spread cores reads across percent of the -f period, instead of reading all cores at once.",
+					 .type = OPT_TYPE_INT,
+					 .value.int_value = 0,
+					 .def_val = "0",
+					 .set = 0};
+
+static struct perf_option shed_opt =    {.name = "--shed",
+					 .short_name = "-S",
+					 .arg = "<percent>",
+					 .desc = "Shed monitors of lowest PRIORITY while updates take more than percent of the -f period. Needs monitors with different PRIORITY.",
+					 .type = OPT_TYPE_INT,
+					 .value.int_value = 0,
+					 .def_val = "0",
+					 .set = 0};
+
+static struct perf_option placement_opt = {.name = "--placement",
+					   .short_name = "-P",
+					   .arg = "<policy>",
+					   .desc = "Where sampling threads run: core, housekeeping, outside[:cpulist] (default isolated and nohz_full CPUs), or numa.",
+					   .type = OPT_TYPE_STRING,
+					   .value.str_value = NULL,
+					   .def_val = "core",
+					   .set = 0};
+
+static struct perf_option overhead_opt = {.name = "--max-overhead",
+					  .short_name = "-O",
+					  .arg = "<percent>",
+					  .desc = "Lower sampling rate, decimate reductions, then shed monitors of lowest PRIORITY to use less than percent of the machine CPU time.",
+					  .type = OPT_TYPE_STRING,
+					  .value.str_value = NULL,
+					  .def_val = "0",
+					  .set = 0};
+
 static unsigned set_option(struct perf_option * opt, const char * val){
   switch(opt->type){
   case OPT_TYPE_INT:
@@ -153,6 +225,59 @@ static void usage(char* argv0, struct perf_option ** options, unsigned n_opt)
   printf("\n");
 }
 
+/* Print sampler wake up lateness histogram, and achieved periods histogram if periods is set */
+static void print_jitter(int periods){
+  unsigned i;
+  struct hmon_sampling_stats stats;
+  hmon_sampling_stats(&stats);
+  fprintf(stderr, "Sampler ticks: %lu, overruns: %lu, mean lateness: %lld ns, max lateness: %lld ns\n",
+	  stats.ticks, stats.overruns, stats.ticks ? stats.lateness_sum / (long long)stats.ticks : 0, stats.lateness_max);
+  for(i=0; i<HMON_LATENESS_BUCKETS; i++){
+    if(i == 0){fprintf(stderr, "%10s < %6u us: %lu\n", "", 1, stats.lateness_hist[i]);}
+    else if(i == HMON_LATENESS_BUCKETS-1){fprintf(stderr, "%6u us <= %10s: %lu\n", 1u<<(i-1), "", stats.lateness_hist[i]);}
+    else{fprintf(stderr, "%6u us <= %3s < %6u us: %lu\n", 1u<<(i-1), "", 1u<<i, stats.lateness_hist[i]);}
+  }
+  if(!periods){return;}
+  fprintf(stderr, "Achieved periods: min %lld ns, max %lld ns\n", stats.period_min, stats.period_max);
+  for(i=0; i<HMON_PERIOD_BUCKETS; i++){
+    if(stats.period_hist[i] == 0){continue;}
+    if(i == HMON_PERIOD_BUCKETS-1){fprintf(stderr, "%10u ns <= %13s: %lu\n", 1u<<i, "", stats.period_hist[i]);}
+    else{fprintf(stderr, "%10u ns <= %3s < %10u ns: %lu\n", i ? 1u<<i : 0, "", 1u<<(i+1), stats.period_hist[i]);}
+  }
+}
+
+/* Set threads placement from policy[:cpulist] */
+static int set_placement(const char * arg){
+  int err;
+  hwloc_bitmap_t cpuset = NULL;
+  const char * list = strchr(arg, ':');
+  size_t len = list != NULL ? (size_t)(list - arg) : strlen(arg);
+  if(len == strlen("core") && !strncmp(arg, "core", len)){return hmon_set_placement(HMON_PLACE_CORE, NULL);}
+  if(len == strlen("housekeeping") && !strncmp(arg, "housekeeping", len)){return hmon_set_placement(HMON_PLACE_HOUSEKEEPING, NULL);}
+  if(len == strlen("numa") && !strncmp(arg, "numa", len)){return hmon_set_placement(HMON_PLACE_NUMA, NULL);}
+  if(len == strlen("outside") && !strncmp(arg, "outside", len)){
+    if(list != NULL){
+      cpuset = hwloc_bitmap_alloc();
+      if(hwloc_bitmap_list_sscanf(cpuset, list+1) == -1){
+	fprintf(stderr, "Invalid cpulist %s\n", list+1);
+	hwloc_bitmap_free(cpuset);
+	return -1;
+      }
+    }
+    err = hmon_set_placement(HMON_PLACE_OUTSIDE, cpuset);
+    if(cpuset != NULL){hwloc_bitmap_free(cpuset);}
+    return err;
+  }
+  fprintf(stderr, "Unknown placement policy %s\n", arg);
+  return -1;
+}
+
+/* Start periodic sampling, busy-polling if requested */
+static int sampling_start(long us){
+  if(busy_opt.set){return hmon_busy_poll_start(location_parse(hmon_topology, busy_opt.value.str_value), 1000LL * us);}
+  return hmon_sampling_start(us);
+}
+
 static void finalize_handler(int sig){
   if(sig == SIGINT || sig == SIGQUIT || sig == SIGTERM){
     hmonitor_utility_stop = 1;
@@ -162,7 +287,7 @@ static void finalize_handler(int sig){
 int
 main (int argc, char *argv[])
 {
-  const unsigned n_opt = 8;
+  const unsigned n_opt = 16;
   struct perf_option * options[n_opt];
   options[0] = &input_opt;
   options[1] = &refresh_opt;
@@ -171,7 +296,15 @@ main (int argc, char *argv[])
   options[4] = &display_opt;
   options[5] = &restrict_opt;
   options[6] = &plugins_opt;
-  options[7] = &perf_opt;        
+  options[7] = &perf_opt;
+  options[8] = &freerun_opt;
+  options[9] = &catchup_opt;
+  options[10] = &realtime_opt;
+  options[11] = &busy_opt;
+  options[12] = &stagger_opt;
+  options[13] = &shed_opt;
+  options[14] = &placement_opt;
+  options[15] = &overhead_opt;
   char * runnable = NULL;
   char ** run_args = NULL;
 
@@ -248,12 +381,13 @@ main (int argc, char *argv[])
     
   /* Translate pid_opt to pid value */
   pid_t pid = 0;
+  int status = EXIT_SUCCESS;
   if(pid_opt.set){
     pid = (pid_t) pid_opt.value.int_value;
   }
 
   /* Monitors initialization */
-  hmon_lib_init(NULL);
+  if(hmon_lib_init(NULL, realtime_opt.set ? realtime_opt.value.int_value : 0) == -1){exit(EXIT_FAILURE);}
 
   /* Restrict monitors */
   if(restrict_opt.set){
@@ -282,6 +416,16 @@ main (int argc, char *argv[])
     exit(EXIT_SUCCESS);
   }
 
+  if(freerun_opt.set){hmon_freerun(1);}
+  if(catchup_opt.set){hmon_set_miss_policy(HMON_MISS_CATCHUP);}
+  if(stagger_opt.set){hmon_set_stagger(10LL * stagger_opt.value.int_value * refresh_opt.value.int_value);}
+  if(shed_opt.set){hmon_set_budget(10LL * shed_opt.value.int_value * refresh_opt.value.int_value);}
+  if(overhead_opt.set){hmon_set_max_overhead(atof(overhead_opt.value.str_value) / 100);}
+  if(placement_opt.set && set_placement(placement_opt.value.str_value) == -1){
+    hmon_lib_finalize();
+    exit(EXIT_FAILURE);
+  }
+
   /* Prepare display */
   if(display_opt.set){hmon_display_init(hmon_topology);}
 
@@ -308,30 +452,50 @@ main (int argc, char *argv[])
     if(sigaction(SIGINT, &sa, NULL) == -1){perror("sigaction"); return -1;}
     if(sigaction(SIGTERM, &sa, NULL) == -1){perror("sigaction"); return -1;}
 
-    /* monitor topology */ 
-    while(!hmonitor_utility_stop){
-      hmon_update(1);
-      if(display_opt.set){
-	if(hmon_display_refresh(0) == -1) break;
+    /* monitor topology: output previous update while the new one is collected */ 
+    int epoch, last_epoch = 0;
+    /* Real-time or busy-poll: sample from the periodic thread instead of sleeping a relative time in the loop */
+    if(realtime_opt.set || busy_opt.set){
+      /* No sampler to stop if it did not start */
+      if(sampling_start(refresh_opt.value.int_value) == -1){status = EXIT_FAILURE; goto out_with_lib;}
+      if(display_opt.set){hmon_periodic_display_start(hmon_display_refresh, 0);}
+      while(!hmonitor_utility_stop){usleep(100000);}
+      hmon_sampling_stop();
+      if(display_opt.set){hmon_periodic_display_stop();}
+    } else {
+      while(!hmonitor_utility_stop){
+	if((epoch = hmon_update_async()) != 0){last_epoch = epoch;}
+	hmon_output();
+	if(display_opt.set){
+	  if(hmon_display_refresh(0) == -1) break;
+	}
+	usleep(refresh_opt.value.int_value);
       }
-      usleep(refresh_opt.value.int_value);
+      hmon_wait(last_epoch);
+      hmon_output();
     }
   }
     
   if(pid>0){
     int err;
-    int status;
-    if(!refresh_opt.set){
+    int child_status;
+    if(!refresh_opt.set && !busy_opt.set){
       hmon_update(1);
-      waitpid(pid, &status, 0);
+      waitpid(pid, &child_status, 0);
       hmon_update(1);
       if(display_opt.set){hmon_display_refresh(1);}
     }
     else{
-      hmon_sampling_start(refresh_opt.value.int_value);
+      /* No sampler to stop if it did not start: don't leave the executable running unmonitored */
+      if(sampling_start(refresh_opt.value.int_value) == -1){
+	kill(pid, SIGTERM);
+	waitpid(pid, &child_status, 0);
+	status = EXIT_FAILURE;
+	goto out_with_lib;
+      }
       if(display_opt.set){hmon_periodic_display_start(hmon_display_refresh, 1);}
     hmon_wait_child:
-      err = waitpid(pid, &status, 0);
+      err = waitpid(pid, &child_status, 0);
       if(err < 0){
 	if(errno == EINTR){goto hmon_wait_child;}
 	perror("waitpid");
@@ -340,13 +504,18 @@ main (int argc, char *argv[])
       if(display_opt.set){hmon_periodic_display_stop();}
     }
   }
+
+  if(realtime_opt.set || busy_opt.set){print_jitter(busy_opt.set);}
     
   /* cleanup */
 out_with_lib:
   free(restrict_opt.value.str_value);
+  free(busy_opt.value.str_value);
+  free(placement_opt.value.str_value);
+  free(overhead_opt.value.str_value);
   hwloc_bitmap_free(restrict_domain);
   if(display_opt.set) hmon_display_finalize();
   hmon_lib_finalize();
-  return EXIT_SUCCESS;
+  return status;
 }
 
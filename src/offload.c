@@ -0,0 +1,189 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./internal.h"
+#include "./hmon/hmonitor.h"
+#include "./hmon/harray.h"
+
+/* Default number of workers, overridden with HMON_OFFLOAD_THREADS environment variable */
+#define HMON_OFFLOAD_THREADS 2
+
+/* A heavy reduction: a copy of the monitor window reduced by a worker */
+struct hmon_offload{
+  struct hmon copy;     /* Shallow copy of the monitor, with its own window and samples */
+  int         busy;     /* The reduction is queued or running */
+  int         done;     /* Samples are ready to be published */
+};
+
+/* A worker and its deque of reductions. Owner pops at the back, thieves steal at the front */
+struct hmon_worker{
+  pthread_t        tid;
+  pthread_mutex_t  lock;
+  harray           deque;
+};
+
+static struct hmon_worker * workers = NULL;
+static unsigned             n_workers = 0;
+static unsigned             next_worker = 0;       /* Round robin submission */
+static int                  queued = 0;            /* Number of reductions in deques */
+static int                  stop = 0;
+static pthread_mutex_t      sleep_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t       sleep_cond = PTHREAD_COND_INITIALIZER;
+
+static struct hmon_offload * hmon_worker_pop(struct hmon_worker * w, int steal){
+  struct hmon_offload * task;
+  pthread_mutex_lock(&w->lock);
+  task = steal ? harray_remove(w->deque, 0) : harray_pop(w->deque);
+  pthread_mutex_unlock(&w->lock);
+  if(task != NULL){__sync_fetch_and_sub(&queued, 1);}
+  return task;
+}
+
+/* Get a reduction from own deque, else steal one from other workers */
+static struct hmon_offload * hmon_worker_get(unsigned self){
+  unsigned i;
+  struct hmon_offload * task = hmon_worker_pop(&workers[self], 0);
+  for(i=1; task == NULL && i<n_workers; i++){task = hmon_worker_pop(&workers[(self+i)%n_workers], 1);}
+  return task;
+}
+
+static void * hmon_worker_thread(void * arg){
+  unsigned self = (unsigned)(unsigned long)arg;
+  struct hmon_offload * task;
+
+  while(1){
+    /* Sleep until some reduction is queued */
+    pthread_mutex_lock(&sleep_lock);
+    while(__sync_fetch_and_add(&queued, 0) == 0 && !stop){pthread_cond_wait(&sleep_cond, &sleep_lock);}
+    pthread_mutex_unlock(&sleep_lock);
+    if(stop){break;}
+
+    while((task = hmon_worker_get(self)) != NULL){
+      task->copy.model(&task->copy);
+      task->done = 1;
+      __sync_fetch_and_and(&task->busy, 0);
+    }
+  }
+  return NULL;
+}
+
+static void hmon_offload_init(){
+  unsigned i;
+  int err;
+  char * env = getenv("HMON_OFFLOAD_THREADS");
+
+  n_workers = env != NULL && atoi(env) > 0 ? (unsigned)atoi(env) : HMON_OFFLOAD_THREADS;
+  stop = 0;
+  queued = 0;
+  malloc_chk(workers, sizeof(*workers) * n_workers);
+  for(i=0; i<n_workers; i++){
+    pthread_mutex_init(&workers[i].lock, NULL);
+    workers[i].deque = new_harray(sizeof(struct hmon_offload *), 16, NULL);
+  }
+  /* Workers are not bound: they run wherever the scheduler finds room */
+  for(i=0; i<n_workers; i++){
+    if((err = pthread_create(&workers[i].tid, NULL, hmon_worker_thread, (void*)(unsigned long)i)) != 0){
+      monitor_print_err("pthread_create: %s\n", strerror(err));
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+void hmon_offload_finalize(){
+  unsigned i;
+  if(workers == NULL){return;}
+  pthread_mutex_lock(&sleep_lock);
+  stop = 1;
+  pthread_cond_broadcast(&sleep_cond);
+  pthread_mutex_unlock(&sleep_lock);
+  for(i=0; i<n_workers; i++){
+    pthread_join(workers[i].tid, NULL);
+    delete_harray(workers[i].deque);
+    pthread_mutex_destroy(&workers[i].lock);
+  }
+  free(workers);
+  workers = NULL;
+  n_workers = 0;
+}
+
+void hmon_offload_attach(hmon m){
+  struct hmon_offload * task;
+  if(m->model == NULL || m->offload != NULL){return;}
+  if(workers == NULL){hmon_offload_init();}
+  malloc_lines_chk(task, sizeof(*task));
+  task->copy = *m;
+  malloc_lines_chk(task->copy.events, sizeof(double) * m->capacity * m->n_events);
+  malloc_lines_chk(task->copy.timestamps, sizeof(int64_t) * m->capacity);
+  malloc_lines_chk(task->copy.row, sizeof(double) * m->n_events);
+  malloc_lines_chk(task->copy.view, sizeof(double) * m->n_events);
+  malloc_lines_chk(task->copy.samples, sizeof(double) * m->n_samples);
+  task->busy = task->done = 0;
+  m->offload = task;
+}
+
+void hmon_offload_detach(hmon m){
+  struct hmon_offload * task = m->offload;
+  if(task == NULL){return;}
+  while(__sync_fetch_and_add(&task->busy, 0)){sched_yield();}
+  m->userdata = task->copy.userdata;
+  free(task->copy.events);
+  free(task->copy.timestamps);
+  free(task->copy.row);
+  free(task->copy.view);
+  free(task->copy.samples);
+  free(task);
+  m->offload = NULL;
+}
+
+void hmon_offload_reserve(unsigned n){
+  unsigned i;
+  for(i=0; i<n_workers; i++){harray_reserve(workers[i].deque, n);}
+}
+
+int hmon_offload_reduce(hmon m){
+  struct hmon_offload * task = m->offload;
+  struct hmon_worker * w;
+  struct hmon buffers;
+  int published = 0;
+
+  /* Previous reduction is still running: this window is not reduced */
+  if(__sync_fetch_and_add(&task->busy, 0)){return 0;}
+
+  /* Publish previous reduction */
+  if(task->done){
+    memcpy(m->samples, task->copy.samples, sizeof(double) * m->n_samples);
+    m->samples_epoch = task->copy.samples_epoch;
+    /* Models state (e.g. a fitted model) built by the worker copy */
+    m->userdata = task->copy.userdata;
+    task->done = 0;
+    published = 1;
+  }
+
+  /* Copy the window and queue its reduction */
+  buffers = task->copy;
+  task->copy = *m;
+  task->copy.events = buffers.events;
+  task->copy.timestamps = buffers.timestamps;
+  task->copy.row = buffers.row;
+  task->copy.view = buffers.view;
+  task->copy.samples = buffers.samples;
+  task->copy.userdata = buffers.userdata;
+  task->copy.counts = NULL;
+  memcpy(task->copy.events, m->events, sizeof(double) * m->capacity * m->n_events);
+  memcpy(task->copy.timestamps, m->timestamps, sizeof(int64_t) * m->capacity);
+  memcpy(task->copy.row, m->row, sizeof(double) * m->n_events);
+  memcpy(task->copy.samples, m->samples, sizeof(double) * m->n_samples);
+  task->copy.samples_epoch = m->epochs[m->last];
+  task->busy = 1;
+
+  w = &workers[__sync_fetch_and_add(&next_worker, 1) % n_workers];
+  pthread_mutex_lock(&w->lock);
+  harray_push(w->deque, task);
+  pthread_mutex_unlock(&w->lock);
+  __sync_fetch_and_add(&queued, 1);
+  pthread_mutex_lock(&sleep_lock);
+  pthread_cond_signal(&sleep_cond);
+  pthread_mutex_unlock(&sleep_lock);
+  return published;
+}
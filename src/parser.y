@@ -16,6 +16,7 @@
    * PERF_LIB:=fake;
    * EVSET:=FAKE_MONITOR;
    * WINDOW:=1;
+   * PERIOD:=1;
    * %syntax: output0=input1 OP inputk... , output1=...
    * %REDUCTION:=$0=$1/2+$0/2, $1=$1*$0/2;
    * %this reduction output the variance of events. Syntax: number_of_output#function
@@ -36,6 +37,10 @@
   char *                     code;
   int                        display;
   unsigned                   window;
+  unsigned                   period;
+  unsigned                   period_max;
+  int                        heavy;
+  int                        priority;
   unsigned                   location_depth;
   int                        location_index;
   harray                     events;
@@ -50,6 +55,10 @@
     empty_harray(events);
     empty_harray(reductions);
     window                 = 1;        /* default store 1 sample */
+    period                 = 1;        /* default sample at each update */
+    period_max             = 1;        /* default fixed period */
+    heavy                  = 0;        /* default reduce in sampling thread */
+    priority               = 0;        /* default shed first under overload */
     display                = 0;        /* default do not display */     
     location_depth         = 0;        /* default on root */
     location_index         = -1;       /* default to no special index */    
@@ -144,7 +153,13 @@
 			    perf_plugin_name,
 			    model_plugin,
 			    output);
-      if(m!=NULL){if(hmon_register_hmonitor(m, display) == -1){delete_hmonitor(m);}}
+      if(m!=NULL){
+	m->period = m->period_min = period;
+	m->period_max = period_max;
+	m->heavy = heavy;
+	m->priority = priority;
+	if(hmon_register_hmonitor(m, display) == -1){delete_hmonitor(m);}
+      }
     } else{
       while((obj = hwloc_get_next_obj_inside_cpuset_by_depth(hmon_topology, root->cpuset, location_depth, obj)) != NULL){
 	hmon m = new_hmonitor(id,
@@ -157,8 +172,13 @@
 			      perf_plugin_name,
 			      model_plugin,
 			      output);
-	if(m!=NULL){if(hmon_register_hmonitor(m, display) == -1){delete_hmonitor(m);}}
-	m->output = output;
+	if(m!=NULL){
+	  m->period = m->period_min = period;
+	  m->period_max = period_max;
+	  m->heavy = heavy;
+	  m->priority = priority;
+	  if(hmon_register_hmonitor(m, display) == -1){delete_hmonitor(m);}
+	}
       }
     }    
     free(event_names);
@@ -182,7 +202,7 @@
   %}
 
 %error-verbose
-%token <str> OBJ_FIELD EVSET_FIELD PERF_LIB_FIELD REDUCTION_FIELD WINDOW_FIELD OUTPUT_FIELD DISPLAY_FIELD INTEGER REAL NAME PATH VAR PERF_CTR NET_CTR
+%token <str> OBJ_FIELD EVSET_FIELD PERF_LIB_FIELD REDUCTION_FIELD WINDOW_FIELD PERIOD_FIELD HEAVY_FIELD PRIORITY_FIELD OUTPUT_FIELD DISPLAY_FIELD INTEGER REAL NAME PATH VAR PERF_CTR NET_CTR
 
 %type <str> term associative_expr commutative_expr associative_op commutative_op event 
 
@@ -248,6 +268,19 @@ field
   free($2);  
  }
 | WINDOW_FIELD     INTEGER   ';' {window = atoi($2); free($2);}
+| PERIOD_FIELD     INTEGER   ';' {
+  if(atoi($2) <= 0) perror_EXIT("Monitor period must be a positive number of updates.\n");
+  period = period_max = atoi($2);
+  free($2);
+ }
+| PERIOD_FIELD     INTEGER ':' INTEGER ';' {
+  if(atoi($2) <= 0 || atoi($4) < atoi($2)) perror_EXIT("Monitor adaptive period must be min:max, with 0 < min <= max.\n");
+  period = atoi($2);
+  period_max = atoi($4);
+  free($2); free($4);
+ }
+| HEAVY_FIELD      INTEGER   ';' {heavy = atoi($2); free($2);}
+| PRIORITY_FIELD   INTEGER   ';' {priority = atoi($2); free($2);}
 | EVSET_FIELD event_list     ';' {}
 ;
 
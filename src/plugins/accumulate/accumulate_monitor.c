@@ -10,6 +10,7 @@
 struct accumulate_eventset{
   hwloc_obj_t location;
   harray child_events;
+  int epoch;            /* Oldest epoch of children samples in last read */
 };
 
 
@@ -37,6 +38,25 @@ char ** hmonitor_events_list(int * n_events){
   return names;
 }
 
+int hmonitor_eventset_init(void ** monitor_eventset, hwloc_obj_t location){
+  struct accumulate_eventset *  set;
+  malloc_chk(set, sizeof(*set));
+  set->location = location;
+  set->child_events =  new_harray(sizeof(hmon), 4, NULL);
+  set->epoch = 0;
+  *monitor_eventset = (void *)set;
+  return 0;
+}
+
+int hmonitor_eventset_destroy(void * eventset){
+  if(eventset == NULL)
+    return 0;
+  struct accumulate_eventset * set = (struct accumulate_eventset *) eventset;
+  delete_harray(set->child_events);
+  free(set);
+  return 1;
+}
+
 int hmonitor_eventset_add_named_event(void * monitor_eventset, const char * event)
 {
   struct accumulate_eventset * set = (struct accumulate_eventset *) monitor_eventset;
@@ -116,23 +136,31 @@ int hmonitor_eventset_read(void * monitor_eventset, double * values){
   double * events;
     
   m = harray_get(set->child_events,0);
-  hmonitor_read(m);
-  hmonitor_reduce(m);
+  if(m->epoch != m->due){
+    hmonitor_read(m);
+    hmonitor_reduce(m);
+  }
   events = hmonitor_get_events(m, m->last);
   for(j=0; j<m->n_events; j++){values[j] = events[j];}
+  set->epoch = hmonitor_get_epoch(m, m->last);
     
   for(i = 1; i< harray_length(set->child_events); i++){
     m  = harray_get(set->child_events,i);
-    /* make sure m is up to date */
-    if(hmonitor_trylock(m, 1) == 1){
+    /* make sure m is up to date, if it is due at this epoch. Otherwise consume its last samples */
+    if(m->epoch != m->due && hmonitor_trylock(m, 1) == 1){
       hmonitor_read(m);
       hmonitor_reduce(m);
       hmonitor_release(m);
     }
     events = hmonitor_get_events(m, m->last);
     for(j=0; j<m->n_events; j++){values[j] += events[j];}
+    if(hmonitor_get_epoch(m, m->last) < set->epoch){set->epoch = hmonitor_get_epoch(m, m->last);}
   }
 
   return 0;
 }
 
+int hmonitor_eventset_epoch(void * monitor_eventset){
+  return ((struct accumulate_eventset *) monitor_eventset)->epoch;
+}
+
@@ -1,5 +1,6 @@
 #include "../../hmon.h"
 #include "../../internal.h"
+#include <limits.h>
 #include <string.h>
 
 /**
@@ -10,6 +11,7 @@
 struct hierarchical_eventset{
   hwloc_obj_t location;
   harray child_events;
+  int epoch;            /* Oldest epoch of children samples in last read */
 };
 
 
@@ -42,6 +44,7 @@ int hmonitor_eventset_init(void ** monitor_eventset, hwloc_obj_t location){
   malloc_chk(set, sizeof(*set));
   set->location = location;
   set->child_events =  new_harray(sizeof(hmon), 4, NULL);
+  set->epoch = 0;
   *monitor_eventset = (void *)set;
   return 0;
 }
@@ -129,17 +132,23 @@ int hmonitor_eventset_read(void * monitor_eventset, double * values){
   struct hierarchical_eventset * set = (struct hierarchical_eventset *) monitor_eventset;
   unsigned i,j, offset = 0;
   hmon m;
+  set->epoch = INT_MAX;
   for(j=0; j<harray_length(set->child_events); j++){
     m = harray_get(set->child_events, j);
-    /* make sure m is up to date */
-    if(hmonitor_trylock(m, 1) == 1){
+    /* make sure m is up to date, if it is due at this epoch. Otherwise consume its last samples */
+    if(m->epoch != m->due && hmonitor_trylock(m, 1) == 1){
       hmonitor_read(m);
       hmonitor_reduce(m);
       hmonitor_release(m);
     }
     for(i=0;i<m->n_samples;i++){values[i+offset] = m->samples[i];}
     offset+=i;
+    if(m->samples_epoch < set->epoch){set->epoch = m->samples_epoch;}
   }
   return 0;
 }
 
+int hmonitor_eventset_epoch(void * monitor_eventset){
+  return ((struct hierarchical_eventset *) monitor_eventset)->epoch;
+}
+
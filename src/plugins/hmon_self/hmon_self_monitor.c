@@ -0,0 +1,119 @@
+#include <string.h>
+#include "../../hmon.h"
+#include "../../internal.h"
+#include "../performance_plugin.h"
+
+/**
+ * Self-instrumentation of the sampling engine.
+ * Events: time in nanoseconds spent by the engine in each phase, on cores of the monitor location (see hmon_self_times()),
+ * and READ_<monitor_id>: time spent reading eventsets of monitors <monitor_id> below the monitor location.
+ **/
+
+#define READ_PREFIX "READ_"
+
+static const char * phase_names[HMON_PHASE_COUNT] = {"STOP", "READ", "REDUCE", "START", "OUTPUT", "WAIT"};
+
+struct self_event{
+  int    phase;    /* Phase index, or -1 for monitors read time */
+  char * id;       /* Monitors id for read time */
+};
+
+struct self_eventset{
+  hwloc_obj_t         location;
+  unsigned            n_events;
+  struct self_event * events;
+  double *            start;     /* Values at eventset start */
+};
+
+char ** hmonitor_events_list(int * n_events){
+  unsigned i;
+  char ** names;
+  malloc_chk(names, sizeof(*names) * (HMON_PHASE_COUNT+1));
+  for(i=0; i<HMON_PHASE_COUNT; i++){names[i] = strdup(phase_names[i]);}
+  names[i] = strdup(READ_PREFIX "<monitor_id>");
+  *n_events = HMON_PHASE_COUNT+1;
+  return names;
+}
+
+int hmonitor_eventset_init(void ** monitor_eventset, hwloc_obj_t location){
+  struct self_eventset * set;
+  malloc_chk(set, sizeof(*set));
+  set->location = location;
+  set->n_events = 0;
+  set->events = NULL;
+  set->start = NULL;
+  *monitor_eventset = set;
+  return 0;
+}
+
+int hmonitor_eventset_destroy(void * eventset){
+  unsigned i;
+  struct self_eventset * set = (struct self_eventset *) eventset;
+  for(i=0; i<set->n_events; i++){free(set->events[i].id);}
+  free(set->events);
+  free(set->start);
+  free(set);
+  return 0;
+}
+
+int hmonitor_eventset_add_named_event(void * monitor_eventset, const char * event){
+  int phase;
+  struct self_eventset * set = (struct self_eventset *) monitor_eventset;
+  for(phase=0; phase<HMON_PHASE_COUNT && strcmp(event, phase_names[phase]); phase++);
+  if(phase == HMON_PHASE_COUNT){
+    if(strncmp(event, READ_PREFIX, strlen(READ_PREFIX)) || event[strlen(READ_PREFIX)] == '\0'){return -1;}
+    phase = -1;
+  }
+  realloc_chk(set->events, sizeof(*set->events) * (set->n_events+1));
+  realloc_chk(set->start, sizeof(*set->start) * (set->n_events+1));
+  set->events[set->n_events].phase = phase;
+  set->events[set->n_events].id = phase < 0 ? strdup(event + strlen(READ_PREFIX)) : NULL;
+  set->start[set->n_events] = 0;
+  set->n_events++;
+  return 1;
+}
+
+int hmonitor_eventset_init_fini(__attribute__ ((unused)) void * monitor_eventset){return 0;}
+
+/* Cumulated time of events since library initialization */
+static void self_read(struct self_eventset * set, double * values){
+  unsigned i, j;
+  hmon m;
+  unsigned long long times[HMON_PHASE_COUNT];
+  hmon_self_times(set->location, times);
+  for(i=0; i<set->n_events; i++){
+    if(set->events[i].phase >= 0){values[i] = times[set->events[i].phase]; continue;}
+    values[i] = 0;
+    for(j=0; j<harray_length(monitors); j++){
+      m = harray_get(monitors, j);
+      if(!strcmp(m->id, set->events[i].id) && hwloc_bitmap_isincluded(m->location->cpuset, set->location->cpuset)){
+	values[i] += m->read_time;
+      }
+    }
+  }
+}
+
+/* Values are counted from eventset start */
+int hmonitor_eventset_start(void * monitor_eventset){
+  struct self_eventset * set = (struct self_eventset *) monitor_eventset;
+  self_read(set, set->start);
+  return 0;
+}
+
+int hmonitor_eventset_stop(__attribute__ ((unused)) void * monitor_eventset){return 0;}
+
+int hmonitor_eventset_reset(void * monitor_eventset){
+  return hmonitor_eventset_start(monitor_eventset);
+}
+
+int hmonitor_eventset_read(void * monitor_eventset, double * values){
+  unsigned i;
+  struct self_eventset * set = (struct self_eventset *) monitor_eventset;
+  self_read(set, values);
+  for(i=0; i<set->n_events; i++){values[i] -= set->start[i];}
+  return 0;
+}
+
+int hmonitor_eventset_flags(__attribute__ ((unused)) void * monitor_eventset){
+  return HMONITOR_EVENTSET_CUMULATIVE;
+}
@@ -1,14 +1,25 @@
 #include "../../hmon.h"
 #include "learning.h"
 
+/* Copy reads in window into a new matrix, oldest first: one row per read, with events then timestamp columns */
+static gsl_matrix * window_matrix(hmon monitor){
+    unsigned first, n1, r, e, row, m = hmonitor_get_window(monitor, &first, &n1);
+    gsl_matrix * mat = gsl_matrix_alloc(m, monitor->n_events+1);
+    for(r=0; r<m; r++){
+	row = (first + r) & (monitor->capacity-1);
+	for(e=0; e<monitor->n_events; e++){gsl_matrix_set(mat, r, e, hmonitor_get_event(monitor, row, e));}
+	gsl_matrix_set(mat, r, monitor->n_events, hmonitor_get_timestamp(monitor, row));
+    }
+    return mat;
+}
+
 /**
  * Perform K-mean clustering into K clusters on events, and output each event label.
  **/
 void clustering(hmon monitor){
     /* Normalize events */
     unsigned m = monitor->total>monitor->window ? monitor->window : monitor->total;
-    gsl_matrix events = to_gsl_matrix(monitor->events, m, monitor->n_events+1);
-    gsl_matrix * normalized_events = gsl_matrix_dup(&events);
+    gsl_matrix * normalized_events = window_matrix(monitor);
     gsl_matrix_normalize_columns(normalized_events, NULL);
     
     /* centroids move */
@@ -26,11 +37,11 @@ void clustering(hmon monitor){
 void lsq_fit(hmon monitor){
     double * output = monitor->samples;
     unsigned m = monitor->total>monitor->window ? monitor->window : monitor->total;
-    gsl_matrix events = to_gsl_matrix(monitor->events, m, monitor->n_events+1);
+    gsl_matrix * events = window_matrix(monitor);
     /* Extract features(events without timesteps and target) and target(first event) */
     gsl_vector Theta = to_gsl_vector(&monitor->samples[1], monitor->n_events-1);
-    gsl_vector_const_view y = gsl_matrix_const_column(&events, 0);
-    gsl_matrix_const_view X = gsl_matrix_const_submatrix(&events, 0, 1, m, monitor->n_events-1);
+    gsl_vector_const_view y = gsl_matrix_const_column(events, 0);
+    gsl_matrix_const_view X = gsl_matrix_const_submatrix(events, 0, 1, m, monitor->n_events-1);
     
     /* Output coefficient of determination */
     double SS_res, SS_tot;
@@ -52,12 +63,13 @@ void lsq_fit(hmon monitor){
     *output = 1-SS_res/SS_tot;
     
     /* Fit full matrix only */
-    if(monitor->last == monitor->window-1){
+    if(monitor->total % monitor->window == 0){
 	/* Build the model */
 	lm lm = monitor->userdata;
 	if(lm == NULL){lm = monitor->userdata = new_linear_model(monitor->n_events-1, LAMBDA);}
 	linear_model_fit(lm, &X.matrix, &Theta, &y.vector);
     }
+    gsl_matrix_free(events);
 }
 
 
@@ -9,6 +9,7 @@ struct PAPI_eventset{
     int evset;
     unsigned n_events;
     long long * values;
+    int attached;      /* Eventset is attached to a cpu, and can be read from any cpu */
 };
 
 void
@@ -168,6 +169,7 @@ int hmonitor_eventset_init(void ** eventset, hwloc_obj_t location){
     evset->n_events=0;
     evset->evset = PAPI_NULL;
     evset->values = NULL;
+    evset->attached = 0;
     PAPI_call_check(PAPI_create_eventset(&evset->evset), PAPI_OK, -1, "Eventset creation failed: ");
 
     /* assign eventset to a component */
@@ -182,6 +184,7 @@ int hmonitor_eventset_init(void ** eventset, hwloc_obj_t location){
 	cpu_option.cpu.eventset=evset->evset;
 	cpu_option.cpu.cpu_num = location->os_index;
 	PAPI_call_check(PAPI_set_opt(PAPI_CPU_ATTACH,&cpu_option), PAPI_OK, -1, "Failed to bind eventset to cpu: ");
+	evset->attached = 1;
     }
 
     if(cidx < 0){
@@ -232,6 +235,12 @@ int hmonitor_eventset_reset(void * eventset){
     return 0;
 }
 
+int hmonitor_eventset_flags(void * eventset){
+    struct PAPI_eventset * evset = (struct PAPI_eventset *) eventset;
+    /* PAPI_read does not reset counters */
+    return HMONITOR_EVENTSET_CUMULATIVE | (evset->attached ? HMONITOR_EVENTSET_REMOTE : 0);
+}
+
 int hmonitor_eventset_read(void* eventset, double * values){
     struct PAPI_eventset * evset = (struct PAPI_eventset *) eventset;
     int err = PAPI_read(evset->evset, evset->values);
@@ -244,3 +253,14 @@ int hmonitor_eventset_read(void* eventset, double * values){
     return 0;
 }
 
+int hmonitor_eventset_read_u64(void* eventset, uint64_t * values){
+    struct PAPI_eventset * evset = (struct PAPI_eventset *) eventset;
+    /* PAPI counts are long long: read them in place */
+    int err = PAPI_read(evset->evset, (long long *)values);
+    if(err != PAPI_OK){
+	PAPI_handle_error(err);
+	return -1;
+    }
+    return 0;
+}
+
@@ -1,6 +1,7 @@
 #ifndef HMON_PERFORMANCE_PLUGIN_H
 #define HMON_PERFORMANCE_PLUGIN_H
 
+#include <stdint.h>
 #include <hwloc.h>
 
 ///////////////////////////////////////// PART TO BE IMPLEMENTED BY A USER LIBRARY /////////////////////////////////////////////
@@ -75,4 +76,43 @@ int hmonitor_eventset_reset(void * monitor_eventset);
  */  
 int hmonitor_eventset_read(void * monitor_eventset, double * values);
 
+/**
+ * Optional function to read events as exact 64 bits counts, e.g. hardware counters.
+ * When implemented, it is called instead of hmonitor_eventset_read(): the monitor stores integer counts, and free-running
+ * differences are exact. Each read is also converted to double into the monitor events.
+ * @param monitor_eventset, the structure containing the set of variable to use.
+ * @param values, the array of counts to update.
+ * @return 0 on success to read events. -1 if read error occured.
+ */
+int hmonitor_eventset_read_u64(void * monitor_eventset, uint64_t * values);
+
+/**
+ * Read values are counters accumulated since eventset start, and the eventset can be read while counting.
+ **/
+#define HMONITOR_EVENTSET_CUMULATIVE 1
+
+/**
+ * The eventset counts for its location whatever the cpu reading it, e.g system files or events attached to a cpu.
+ **/
+#define HMONITOR_EVENTSET_REMOTE     2
+
+/**
+ * Optional function returning eventset properties.
+ * When the flag HMONITOR_EVENTSET_CUMULATIVE is set, free-running monitors keep the eventset counting,
+ * and store the difference between two consecutive reads.
+ * When the flag HMONITOR_EVENTSET_REMOTE is set, and a core carries only such monitors, they are read
+ * from a thread shared by the package instead of waking the core up.
+ * @param monitor_eventset, the structure containing the set of variable to use.
+ * @return A combination of HMONITOR_EVENTSET_* flags.
+ */
+int hmonitor_eventset_flags(void * monitor_eventset);
+
+/**
+ * Optional function for eventsets reading other monitors.
+ * Monitors whose eventset read children samples from an epoch older than their own read count a stale read.
+ * @param monitor_eventset, the structure containing the set of variable to use.
+ * @return The oldest epoch of monitors samples read during last eventset read.
+ */
+int hmonitor_eventset_epoch(void * monitor_eventset);
+
 #endif
@@ -182,6 +182,9 @@ int hmonitor_eventset_stop(void * monitor_eventset){/*Nothing to do*/}
 
 int hmonitor_eventset_reset(void * monitor_eventset){/*TODO*/}
 
+/* /proc files describe their location whatever the reader */
+int hmonitor_eventset_flags(__attribute__ ((unused)) void * monitor_eventset){return HMONITOR_EVENTSET_REMOTE;}
+
 int hmonitor_eventset_read(void * monitor_eventset, double * values){
   struct proc_eventset * evset = (struct proc_eventset *)(monitor_eventset);
 
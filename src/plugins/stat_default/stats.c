@@ -4,46 +4,56 @@
 #define STAT_MAX(a,b) ((a)>(b)?(a):(b))
 #define STAT_MIN(a,b) ((a)<(b)?(a):(b))
 
+/* Window rows of each column are two contiguous ranges: [first, first+n1) and [0, rows-n1). Loops are vectorized with -fopenmp-simd */
+
 void hmonitor_events_max(hmon m){
-    unsigned r, rows = STAT_MIN(m->window, m->total);
-    unsigned c, cols = m->n_events;
-    double * out = m->samples, *in;
+    unsigned first, n1, rows = hmonitor_get_window(m, &first, &n1);
+    unsigned r, c, cols = m->n_events;
+    double * out = m->samples, *in, acc;
 
-    /* Init output */
-    for(c=0;c<cols;c++){out[c] = DBL_MIN;}
-    /* compute max row by row */
-    for(r=0; r<rows; r++){
-        in = hmonitor_get_events(m,r);
-	for(c=0;c<cols;c++){out[c] = STAT_MAX(out[c], in[c]);}
+    /* compute max column by column */
+    for(c=0;c<cols;c++){
+	in = hmonitor_get_column(m,c);
+	acc = DBL_MIN;
+#pragma omp simd reduction(max:acc)
+	for(r=first; r<first+n1; r++){acc = STAT_MAX(acc, in[r]);}
+#pragma omp simd reduction(max:acc)
+	for(r=0; r<rows-n1; r++){acc = STAT_MAX(acc, in[r]);}
+	out[c] = acc;
     }
 }
 
 void hmonitor_events_min(hmon m){
-    unsigned r, rows = STAT_MIN(m->window, m->total);
-    unsigned c, cols = m->n_events;
-    double * out = m->samples, *in;
+    unsigned first, n1, rows = hmonitor_get_window(m, &first, &n1);
+    unsigned r, c, cols = m->n_events;
+    double * out = m->samples, *in, acc;
 
-    /* Init output */
-    for(c=0;c<cols;c++){out[c] = DBL_MAX;}
-    /* compute min row by row */
-    for(r=0; r<rows; r++){
-        in = hmonitor_get_events(m,r);
-	for(c=0;c<cols;c++){out[c] = STAT_MIN(out[c], in[c]);}
+    /* compute min column by column */
+    for(c=0;c<cols;c++){
+	in = hmonitor_get_column(m,c);
+	acc = DBL_MAX;
+#pragma omp simd reduction(min:acc)
+	for(r=first; r<first+n1; r++){acc = STAT_MIN(acc, in[r]);}
+#pragma omp simd reduction(min:acc)
+	for(r=0; r<rows-n1; r++){acc = STAT_MIN(acc, in[r]);}
+	out[c] = acc;
     }
 }
 
 void hmonitor_events_sum(hmon m){
-    unsigned r, rows = STAT_MIN(m->window, m->total);
-    unsigned c, cols = m->n_events;
-    double * out = m->samples, *in;
-
-    /* Init output */
-    for(c=0;c<cols;c++){out[c] = 0;}
+    unsigned first, n1, rows = hmonitor_get_window(m, &first, &n1);
+    unsigned r, c, cols = m->n_events;
+    double * out = m->samples, *in, acc;
 
-    /* compute sum row by row */
-    for(r=0; r<rows; r++){
-        in = hmonitor_get_events(m,r);
-	for(c=0;c<cols;c++){out[c] += in[c];}
+    /* compute sum column by column */
+    for(c=0;c<cols;c++){
+	in = hmonitor_get_column(m,c);
+	acc = 0;
+#pragma omp simd reduction(+:acc)
+	for(r=first; r<first+n1; r++){acc += in[r];}
+#pragma omp simd reduction(+:acc)
+	for(r=0; r<rows-n1; r++){acc += in[r];}
+	out[c] = acc;
     }
 }
 
@@ -56,20 +66,19 @@ void hmonitor_events_mean(hmon m){
 }
 
 void hmonitor_events_var(hmon m){
-    unsigned r, rows = STAT_MIN(m->window, m->total);
-    unsigned c, cols = m->n_events;
-    double * out = m->samples, *in;
-    double sum[cols], square_sum[cols], ct = 1.0/((double)rows*rows);
-    
-    for(c=0;c<cols;c++){sum[c] = square_sum[c] = 0;}
-    for(r=0; r<rows; r++){
-        in = hmonitor_get_events(m,r);
-	for(c=0;c<cols;c++){sum[c]+=in[c]; square_sum[c] += in[c]*in[c];}
-    }
+    unsigned first, n1, rows = hmonitor_get_window(m, &first, &n1);
+    unsigned r, c, cols = m->n_events;
+    double * out = m->samples, *in, sum, square_sum, ct = 1.0/((double)rows*rows);
 
-    for(c=0;c<cols;c++){sum[c] = ct*sum[c]*sum[c];}
-    ct = (1.0/(double)rows);
-    for(c=0;c<m->n_samples;c++){out[c] = ct*square_sum[c]-sum[c];}
+    for(c=0;c<cols && c<m->n_samples;c++){
+	in = hmonitor_get_column(m,c);
+	sum = square_sum = 0;
+#pragma omp simd reduction(+:sum,square_sum)
+	for(r=first; r<first+n1; r++){sum += in[r]; square_sum += in[r]*in[r];}
+#pragma omp simd reduction(+:sum,square_sum)
+	for(r=0; r<rows-n1; r++){sum += in[r]; square_sum += in[r]*in[r];}
+	out[c] = square_sum/(double)rows - ct*sum*sum;
+    }
 }
 
 void hmonitor_evset_var(hmon m){
@@ -80,4 +89,3 @@ void hmonitor_evset_var(hmon m){
     for(c=0;c<cols;c++){sum+=in[c]; square_sum += in[c]*in[c];}
     *out = square_sum/(double)cols - (1.0/(double)(cols*cols))*sum*sum;
 }
-
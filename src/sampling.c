@@ -1,91 +1,173 @@
-#include <signal.h>
-#include <sys/time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
 #include "./hmon.h"
+#include "./internal.h"
 
-int handler_isset = 0;
-timer_t update_timer;
+/* A thread calling a function on absolute deadlines */
+struct hmon_periodic{
+  pthread_t  thread;
+  long long  period;       /* Nanoseconds between two deadlines */
+  volatile int stop;
+  int        catchup;      /* Fire missed deadlines back to back instead of skipping them */
+  hwloc_obj_t pu;          /* If not NULL, busy-poll the clock bound on this PU instead of sleeping */
+  void       (* call)(void *);
+  void *     arg;
+  struct hmon_sampling_stats stats;
+};
 
+static struct hmon_periodic sampler;
+static struct hmon_periodic display;
+static int update_epoch = 0;
+static int display_arg;
+static int (*display_function)(int);
 
-timer_t display_timer;
-int display_arg;
-int (*display_function)(int);
-
-void __attribute__ ((constructor)) hmon_block_SIGRTMIN(){
-  /* avoid that signals are caught by threads */
-  sigset_t set;
-  sigemptyset(&set);
-  sigaddset(&set, SIGRTMIN);
-  if(pthread_sigmask(SIG_BLOCK, &set, NULL) == -1){perror("pthread_sigmask");}
+static long long hmon_time(){
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return 1000000000LL * tp.tv_sec + tp.tv_nsec;
 }
 
-static void handler(int sig, siginfo_t *si, void *uc){
-  timer_t * timer = si->si_value.sival_ptr;
-  if(sig == SIGRTMIN){
-    if(*timer == update_timer){
-	hmon_update(1);
+static void * hmon_periodic_thread(void * arg){
+  struct hmon_periodic * p = (struct hmon_periodic *)arg;
+  struct timespec tp;
+  long long now, late, us, missed, tick, last_tick = 0, deadline, first, counted = 0;
+  int bucket;
+
+  if(p->pu != NULL){location_cpubind(hmon_topology, p->pu);}
+  deadline = hmon_time() + p->period;
+  while(!p->stop){
+    /* Wait until deadline. Absolute deadlines do not drift with the time spent in call */
+    if(p->pu != NULL){
+      while((tick = hmon_time()) < deadline && !p->stop){hmon_cpu_relax();}
+    } else {
+      tp.tv_sec = deadline / 1000000000LL;
+      tp.tv_nsec = deadline % 1000000000LL;
+      while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tp, NULL) == EINTR);
+      tick = hmon_time();
+    }
+    if(p->stop){break;}
+
+    /* Record tick lateness */
+    late = tick - deadline;
+    p->stats.ticks++;
+    p->stats.lateness_sum += late;
+    if(late > p->stats.lateness_max){p->stats.lateness_max = late;}
+    for(bucket = 0, us = late/1000; us > 0 && bucket < HMON_LATENESS_BUCKETS-1; us >>= 1){bucket++;}
+    p->stats.lateness_hist[bucket]++;
+
+    /* Record achieved period */
+    if(last_tick > 0){
+      p->stats.period_min = p->stats.period_min == 0 ? tick - last_tick : MIN(p->stats.period_min, tick - last_tick);
+      p->stats.period_max = MAX(p->stats.period_max, tick - last_tick);
+      for(bucket = 0, us = (tick - last_tick) >> 1; us > 0 && bucket < HMON_PERIOD_BUCKETS-1; us >>= 1){bucket++;}
+      p->stats.period_hist[bucket]++;
+    }
+    last_tick = tick;
+
+    p->call(p->arg);
+
+    /* Set next deadline. Deadlines already passed are skipped instead of piling up, unless catching up.
+       Passed deadlines are counted once: those fired back to back when catching up were counted when first passed */
+    deadline += p->period;
+    now = hmon_time();
+    first = MAX(deadline, counted);
+    if(now > first){
+      missed = 1 + (now - first) / p->period;
+      p->stats.overruns += missed;
+      counted = first + missed * p->period;
+      if(!p->catchup){deadline = counted;}
     }
-    if(*timer == display_timer){display_function(display_arg);}
   }
+  return NULL;
 }
 
-static int set_handler(){
-  /* Allow this thread to catch SIGRTMIN */
-  sigset_t set;
-  sigemptyset(&set);
-  sigaddset(&set, SIGRTMIN);
-  if(pthread_sigmask(SIG_UNBLOCK, &set, NULL) == -1){perror("pthread_sigmask"); return -1;}
-
-   /* register handler for SIGRTMIN */
-  struct sigaction sa;
-  sa.sa_flags = SA_SIGINFO;
-  sa.sa_sigaction = handler;
-  sigemptyset(&sa.sa_mask);
-  if(sigaction(SIGRTMIN, &sa, NULL) == -1){perror("sigaction"); return -1;}
-  handler_isset = 1;
+static int hmon_periodic_start(struct hmon_periodic * p, long long ns, hwloc_obj_t pu, int catchup, void (* call)(void*), void * arg){
+  int err;
+  pthread_attr_t attr;
+  if(ns <= 0){fprintf(stderr, "Invalid period %lld ns\n", ns); return -1;}
+  memset(&p->stats, 0, sizeof(p->stats));
+  p->period = ns;
+  p->stop = 0;
+  p->pu = pu;
+  p->catchup = catchup;
+  p->call = call;
+  p->arg = arg;
+  hmon_thread_attr_init(&attr);
+  err = pthread_create(&p->thread, &attr, hmon_periodic_thread, p);
+  pthread_attr_destroy(&attr);
+  if(err != 0){
+    fprintf(stderr, "pthread_create: %s\n", strerror(err));
+    return -1;
+  }
   return 0;
 }
 
-static int create_timer(timer_t * timerid){
-/* Create the timer */
-  struct sigevent sev;
-  sev.sigev_notify = SIGEV_SIGNAL;
-  sev.sigev_signo = SIGRTMIN;
-  sev.sigev_value.sival_ptr = timerid;
-  if(timer_create(CLOCK_REALTIME, &sev, timerid) == -1){perror("timer_create"); return -1;}
+static int hmon_periodic_stop(struct hmon_periodic * p){
+  int err;
+  p->stop = 1;
+  if((err = pthread_join(p->thread, NULL)) != 0){
+    fprintf(stderr, "pthread_join: %s\n", strerror(err));
+    return -1;
+  }
+  return 0;
 }
 
-static int set_timer(timer_t timer, long us){
-  struct itimerspec update_delay;
-  update_delay.it_interval.tv_sec  = us/1000000;
-  update_delay.it_interval.tv_nsec = 1000*(us%1000000);
-  update_delay.it_value = update_delay.it_interval;
-  if(timer_settime(timer, 0, &update_delay, NULL) == -1){perror("timer_settime"); return -1;}
-  return 0;
+static void hmon_sample(__attribute__ ((unused)) void * arg){
+  /* Output previous update while the new one is collected */
+  int epoch = hmon_update_async();
+  if(epoch){update_epoch = epoch;}
+  hmon_output();
+}
+
+static void hmon_display(__attribute__ ((unused)) void * arg){
+  display_function(display_arg);
 }
 
 int hmon_sampling_start(const long us){
-  if(!handler_isset && set_handler() == -1){return -1;}
-  if(create_timer(&update_timer) == -1){return -1;}
-  return set_timer(update_timer, us);
+  /* Updates are late when not complete before next tick */
+  hmon_set_deadline(1000LL * us);
+  return hmon_periodic_start(&sampler, 1000LL * us, NULL, hmon_get_miss_policy() == HMON_MISS_CATCHUP, hmon_sample, NULL);
+}
+
+int hmon_busy_poll_start(hwloc_obj_t pu, const long long ns){
+  if(pu == NULL || pu->type != HWLOC_OBJ_PU){fprintf(stderr, "Busy-poll sampling requires a PU\n"); return -1;}
+  /* A spinning sampler would starve the thread sharing its PU, e.g. under SCHED_FIFO */
+  switch(hmon_threads_on(pu->cpuset)){
+  case -1: fprintf(stderr, "Busy-poll sampling requires started monitors\n"); return -1;
+  case 1: fprintf(stderr, "Busy-poll sampling PU:%u runs a monitor thread\n", pu->logical_index); return -1;
+  default: break;
+  }
+  /* Core threads spin on the epoch flag: no system call between the trigger and the reads */
+  hmon_spin(1);
+  hmon_set_deadline(ns);
+  if(hmon_periodic_start(&sampler, ns, pu, hmon_get_miss_policy() == HMON_MISS_CATCHUP, hmon_sample, NULL) == -1){
+    hmon_spin(0);
+    return -1;
+  }
+  return 0;
 }
 
 int hmon_sampling_stop(){
-  set_timer(update_timer, 0);
-  if(timer_delete(update_timer) == -1){perror("timer_delete"); return -1;}
+  if(hmon_periodic_stop(&sampler) == -1){return -1;}
+  /* Flush last update */
+  hmon_wait(update_epoch);
+  hmon_output();
+  if(sampler.pu != NULL){hmon_spin(0);}
   return 0;
 }
 
+void hmon_sampling_stats(struct hmon_sampling_stats * stats){
+  *stats = sampler.stats;
+}
+
 int hmon_periodic_display_start(int (*display_monitors)(int), int arg){
   display_function = display_monitors;
   display_arg = arg;
-  if(!handler_isset && set_handler() == -1){return -1;}
-  if(create_timer(&display_timer) == -1){return -1;}
-  return set_timer(display_timer, 100000);
+  return hmon_periodic_start(&display, 100000000LL, NULL, 0, hmon_display, NULL);
 }
 
 int hmon_periodic_display_stop(){
-  set_timer(display_timer, 0);
-  if(timer_delete(display_timer) == -1){perror("timer_delete"); return -1;}
-  return 0;
+  return hmon_periodic_stop(&display);
 }
-
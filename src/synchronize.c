@@ -1,4 +1,14 @@
+#include <errno.h>
 #include <pthread.h>
+#include <stdio.h>
+#include <limits.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "./hmon/hmonitor.h"
 #include "./hmon.h"
 #include "./internal.h"
@@ -13,14 +23,618 @@ hwloc_topology_t           hmon_topology;            /* The topology with monito
 hwloc_cpuset_t             allowed_cpuset;           /* The domain monitored */
 
 /** Monitors threads **/
-static unsigned            ncores;                   /* Number of cores inside restrict location */
-static int                 uptodate;                 /* Number of threads uptodate */
-static unsigned            thread_count;             /* Number of threads */
-static pthread_t *         threads;                  /* Threads id */
-static int                 threads_stop = 0;
-static pthread_barrier_t   barrier;                 /* Common barrier between monitors' thread and main thread */
+struct hmon_thread{
+  pthread_t                tid;                      /* Thread id */
+  hwloc_obj_t              core;                     /* Core where the thread is bound, or package of a collector */
+  int                      epoch;                    /* Last epoch processed by this thread */
+  int                      running;                  /* Is the thread spawned */
+  int                      stop;                     /* Ask the thread to exit. Reset by the thread when it exits */
+  unsigned long long       times[HMON_PHASE_COUNT];  /* Time spent in each phase (nanoseconds) */
+  int                      done;                     /* Last epoch completed by this thread */
+  struct hmon_epoch_stats  stats;                    /* Thread epochs accounting. skipped is written by the trigger */
+  double                   phase;                    /* Position of the core reads in the stagger span, in [0,1) */
+  hwloc_bitmap_t           collected;                /* Collectors: logical indexes of cores read remotely. NULL for core threads */
+  long long                finish;                   /* Time when the thread completed its last epoch */
+  harray                   owned;                    /* Objects above cores whose monitors this thread updates, deepest first */
+  hwloc_bitmap_t           cpuset;                   /* PUs where the thread is bound, set on spawn from placement policy */
+};
+
+static unsigned            ncores;                   /* Number of cores in topology */
+static unsigned            nslots;                   /* Number of threads: one per core, then the collectors */
+static unsigned            nthreads;                 /* Number of spawned threads */
+static int                 epoch;                    /* Last published epoch. Threads sleep on this futex */
+static int                 pending;                  /* Number of threads still processing last epoch */
+static int                 snapshot_epoch;           /* Epoch of monitors snapshot */
+static int                 output_epoch;             /* Last epoch printed */
+static unsigned long long  output_time;              /* Time spent printing monitors (nanoseconds) */
+static long long           trigger_time;             /* Time when last epoch was requested */
+static long long           deadline = 0;             /* Time allowed to complete an epoch, 0 if unset */
+static long long           stagger = 0;              /* Time span across which cores reads are spread, 0 to read at trigger time */
+static long long           budget = 0;               /* Epoch cost above which monitors are shed, 0 to never shed */
+static unsigned            relax = 0;                /* Consecutive epochs under half the budget */
+static double              max_overhead = 0;         /* Share of the machine CPU time hmon may use, 0 to not govern */
+static unsigned            govern_level = 0;         /* Governor steps lowering sampling rate, then decimating reductions */
+static unsigned            govern_epochs = 0;        /* Epochs since last governor decision */
+static long long           govern_time = 0;          /* Time of last governor decision */
+static unsigned long long  govern_cpu = 0;           /* hmon CPU time at last governor decision */
+static unsigned            stride = 1;               /* One update request out of stride triggers an epoch */
+static unsigned long       requests = 0;             /* Update requests since library initialization */
+static unsigned            decimate = 1;             /* Monitors reduce one read out of decimate */
+static int                 spin = 0;                 /* Busy-wait on epoch and pending instead of sleeping */
+static int                 epoch_sleepers = 0;       /* Number of threads sleeping on epoch futex */
+static int                 pending_sleepers = 0;     /* Number of threads sleeping on pending futex */
+static int                 miss_policy = HMON_MISS_DROP;
+static int                 rt_priority = 0;          /* SCHED_FIFO priority of sampling threads, 0 for default scheduling */
+static int                 placement = HMON_PLACE_CORE; /* Where sampling threads run */
+static hwloc_bitmap_t      placement_avoid = NULL;   /* PUs left to the application by HMON_PLACE_OUTSIDE */
+static struct hmon_epoch_stats epoch_stats;          /* Global epochs accounting */
+static struct hmon_thread * threads;                 /* One thread per core, then one collector per package, or per NUMA node */
+static int                 threads_started = 0;      /* Threads are spawned from hmon_start() once import is done */
+static int                 threads_dirty = 0;        /* Monitors were registered since threads were spawned */
+
+/** Bottom-up reduction: the last thread done below a topology object flags it ready, and its owner thread updates its monitors **/
+struct hmon_node{
+  int                      threads;                  /* Number of children with threads below them */
+  int                      pending;                  /* Countdown of children still processing the epoch */
+  int                      owner;                    /* Index of the thread updating the object monitors, -1 if it has none */
+  int                      ready;                    /* Last epoch where every child was done. Owner sleeps on this futex */
+  int                      sleepers;                 /* Owner is sleeping on ready */
+};
+static struct hmon_node ** nodes;                    /* One node per topology object: nodes[depth][logical_index] */
 static void *              hmonitor_thread(void * arg);
 
+/** Hierarchical timing wheel firing monitors on their period **/
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1<<WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE-1)
+
+/** Adaptive periods: relative variation of samples above which the period is halved, and below which it is doubled **/
+#define HMON_ADAPT_HIGH 0.1
+#define HMON_ADAPT_LOW  0.01
+/** Load shedding: an epoch over budget sheds one more step of the lowest priority monitors: period x2, x4, x8, then paused.
+    HMON_SHED_RELAX consecutive epochs under half the budget restore one step of the highest priority monitors shed **/
+#define HMON_SHED_PAUSE 4
+#define HMON_SHED_RELAX 8
+/** Overhead governor: every HMON_GOVERN_EPOCHS epochs, hmon CPU share above max_overhead takes one more step: sampling rate
+    is halved HMON_GOVERN_RATE times, then reductions are decimated HMON_GOVERN_DECIMATE times, then monitors are shed.
+    A share under half the maximum takes one step back **/
+#define HMON_GOVERN_EPOCHS   16
+#define HMON_GOVERN_RATE     3
+#define HMON_GOVERN_DECIMATE 3
+static harray              wheel[2][WHEEL_SIZE];     /* Level 0: one slot per epoch. Level 1: one slot per WHEEL_SIZE epochs */
+static int                 wheel_tick;               /* Epoch of the wheel */
+static harray              shortened;                /* Monitors whose period shrank during the epoch, rescheduled on trigger */
+static pthread_mutex_t     shortened_lock = PTHREAD_MUTEX_INITIALIZER;
+static harray              govern_files;             /* Trace files the governor writes to, refreshed on each decision */
+
+static inline long long hmon_clock(){
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return 1000000000LL * tp.tv_sec + tp.tv_nsec;
+}
+
+static inline void futex_wait(int * addr, int val){
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static inline void futex_wake(int * addr){
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Wait once while *addr == val: spin in busy-poll mode, else sleep on the futex, counted in *sleepers */
+static inline void hmon_wait_value(int * addr, const int val, int * sleepers){
+  if(spin){hmon_cpu_relax(); return;}
+  __sync_fetch_and_add(sleepers, 1);
+  futex_wait(addr, val);
+  __sync_fetch_and_sub(sleepers, 1);
+}
+
+/* Wake up threads sleeping on addr. No system call if nobody sleeps */
+static inline void hmon_wake(int * addr, int * sleepers){
+  if(__sync_fetch_and_add(sleepers, 0)){futex_wake(addr);}
+}
+
+/* Wait until absolute time t */
+static void hmon_wait_until(const long long t){
+  struct timespec tp;
+  if(spin){
+    while(hmon_clock() < t){hmon_cpu_relax();}
+    return;
+  }
+  tp.tv_sec = t / 1000000000LL;
+  tp.tv_nsec = t % 1000000000LL;
+  while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tp, NULL) == EINTR);
+}
+
+void hmon_spin(const int enable){
+  __sync_lock_test_and_set(&spin, enable);
+  /* Sleepers start spinning */
+  futex_wake(&epoch);
+  futex_wake(&pending);
+}
+
+/* Store monitor in the slot matching its next due epoch */
+static void hmon_wheel_insert(hmon m){
+  int delta = m->next - wheel_tick;
+  if(delta < WHEEL_SIZE){harray_push(wheel[0][m->next & WHEEL_MASK], m);}
+  else if(delta < WHEEL_SIZE*WHEEL_SIZE){harray_push(wheel[1][(m->next >> WHEEL_BITS) & WHEEL_MASK], m);}
+  /* Too far: store in the last level 1 slot to be inserted again when it is cascaded */
+  else{harray_push(wheel[1][(wheel_tick >> WHEEL_BITS) & WHEEL_MASK], m);}
+}
+
+static void hmon_wheel_remove(hmon m){
+  unsigned i, j;
+  int k;
+  for(i=0; i<2; i++){
+    for(j=0; j<WHEEL_SIZE; j++){
+      if((k = harray_find_unsorted(wheel[i][j], m)) >= 0){harray_remove(wheel[i][j], k); return;}
+    }
+  }
+}
+
+/* Monitors whose period shrank are moved from the slot of their former next epoch. Threads are idle */
+static void hmon_wheel_reschedule(){
+  hmon m;
+  while((m = harray_pop(shortened)) != NULL){
+    hmon_wheel_remove(m);
+    m->next = MAX(m->due + (int)(m->period << MIN(m->shed, HMON_SHED_PAUSE-1)), wheel_tick+1);
+    hmon_wheel_insert(m);
+  }
+}
+
+/* Move wheel to next epoch, and flag monitors due at this epoch */
+static void hmon_wheel_advance(){
+  unsigned i;
+  hmon m;
+  harray slot;
+  wheel_tick++;
+  /* Cascade level 1 slot into level 0 when a level 0 round is over. Monitors still too far are appended to the same slot */
+  if((wheel_tick & WHEEL_MASK) == 0){
+    slot = wheel[1][(wheel_tick >> WHEEL_BITS) & WHEEL_MASK];
+    for(i = harray_length(slot); i > 0; i--){hmon_wheel_insert(harray_remove(slot, i-1));}
+  }
+  /* Fire level 0 slot, and reschedule monitors on their next period */
+  slot = wheel[0][wheel_tick & WHEEL_MASK];
+  while((m = harray_pop(slot)) != NULL){
+    /* Paused monitors are not due, but keep being rescheduled to resume when restored */
+    if(m->shed < HMON_SHED_PAUSE){m->due = wheel_tick;}
+    m->next = wheel_tick + (m->period << MIN(m->shed, HMON_SHED_PAUSE-1));
+    hmon_wheel_insert(m);
+  }
+}
+
+/* Move monitors of priority prio one shed step further (step > 0) or back (step < 0) */
+static void hmon_shed_priority(const int prio, const int step, const long long now){
+  unsigned i;
+  hmon m;
+  for(i=0; i<harray_length(monitors); i++){
+    m = harray_get(monitors, i);
+    if(m->priority != prio || (step > 0 && m->shed >= HMON_SHED_PAUSE) || (step < 0 && m->shed == 0)){continue;}
+    if(m->shed == 0){m->shed_start = now;}
+    m->shed += step;
+    if(m->shed == 0){m->shed_time += now - m->shed_start;}
+  }
+}
+
+/* Shed the lowest priority not paused, but never the highest one (step > 0), or restore the highest priority shed (step < 0).
+   Return a monitor of the priority moved, or NULL if none can move */
+static hmon hmon_shed_step(const int step, const long long now){
+  unsigned i;
+  int top = INT_MIN, prio = step > 0 ? INT_MAX : INT_MIN;
+  hmon m;
+
+  for(i=0; i<harray_length(monitors); i++){
+    m = harray_get(monitors, i);
+    top = MAX(top, m->priority);
+    if(step > 0 && m->shed < HMON_SHED_PAUSE){prio = MIN(prio, m->priority);}
+    if(step < 0 && m->shed > 0){prio = MAX(prio, m->priority);}
+  }
+  if((step > 0 && prio >= top) || (step < 0 && prio == INT_MIN)){return NULL;}
+  hmon_shed_priority(prio, step, now);
+
+  for(i=0; i<harray_length(monitors); i++){
+    m = harray_get(monitors, i);
+    if(m->priority == prio){return m;}
+  }
+  return NULL;
+}
+
+/* Print the shed state of m priority after a step */
+static void hmon_shed_fprint(FILE * f, hmon m, const long long now){
+  if(m->shed == 0){fprintf(f, "priority %d monitors restored after %lld ns\n", m->priority, now - m->shed_start);}
+  else if(m->shed == HMON_SHED_PAUSE){fprintf(f, "priority %d monitors paused\n", m->priority);}
+  else{fprintf(f, "priority %d monitors period x%u\n", m->priority, 1u << m->shed);}
+}
+
+/* Shed or restore monitors according to last epoch cost. Must be called while threads are idle */
+static void hmon_shed(const long long now){
+  unsigned i;
+  int step;
+  long long cost = 0;
+  hmon m;
+
+  for(i=0; i<nslots; i++){if(threads[i].running){cost = MAX(cost, threads[i].finish - trigger_time);}}
+  if(cost > budget){relax = 0; step = 1;}
+  else if(cost >= budget/2){relax = 0; return;}
+  else if(++relax >= HMON_SHED_RELAX){relax = 0; step = -1;}
+  else{return;}
+
+  if((m = hmon_shed_step(step, now)) == NULL){return;}
+  fprintf(stderr, "Epoch cost %lld ns, budget %lld ns: ", cost, budget);
+  hmon_shed_fprint(stderr, m, now);
+}
+
+/* Fill files with distinct trace files of monitors */
+static harray hmon_output_files(harray files){
+  unsigned i;
+  hmon m;
+  empty_harray(files);
+  for(i=0; i<harray_length(monitors); i++){
+    m = harray_get(monitors, i);
+    if(m->output != NULL && harray_find_unsorted(files, m->output) < 0){harray_push(files, m->output);}
+  }
+  return files;
+}
+
+/* CPU time spent by sampling threads and output since library initialization. Spinning threads also burn their waits */
+static unsigned long long hmon_cpu_time(){
+  unsigned i, p;
+  unsigned long long t = output_time;
+  for(i=0; i<nslots; i++){
+    for(p=0; p<HMON_PHASE_COUNT; p++){if(p != HMON_PHASE_WAIT || spin){t += threads[i].times[p];}}
+  }
+  return t;
+}
+
+/* Keep hmon CPU share under max_overhead. Decisions are written as comment lines into traces. Must be called while threads are idle */
+static void hmon_govern(const long long now){
+  unsigned i;
+  unsigned long long cpu;
+  double overhead;
+  harray files;
+  hmon m = NULL;
+
+  if(govern_time == 0){govern_time = now; govern_cpu = hmon_cpu_time(); return;}
+  if(++govern_epochs < HMON_GOVERN_EPOCHS){return;}
+  cpu = hmon_cpu_time();
+  overhead = (double)(cpu - govern_cpu) / ((double)(now - govern_time) * hwloc_get_nbobjs_by_type(hmon_topology, HWLOC_OBJ_PU));
+  govern_epochs = 0;
+  govern_time = now;
+  govern_cpu = cpu;
+
+  /* Lower sampling rate, then decimate reductions, then shed. Step back in reverse order */
+  if(overhead > max_overhead){
+    if(govern_level < HMON_GOVERN_RATE + HMON_GOVERN_DECIMATE){govern_level++;}
+    else if((m = hmon_shed_step(1, now)) == NULL){return;}
+  }
+  else if(overhead < max_overhead/2){
+    if((m = hmon_shed_step(-1, now)) == NULL){
+      if(govern_level == 0){return;}
+      govern_level--;
+    }
+  }
+  else{return;}
+  stride = 1u << MIN(govern_level, HMON_GOVERN_RATE);
+  decimate = 1u << (govern_level > HMON_GOVERN_RATE ? govern_level - HMON_GOVERN_RATE : 0);
+
+  files = hmon_output_files(govern_files);
+  for(i=0; i<harray_length(files); i++){
+    FILE * f = harray_get(files, i);
+    fprintf(f, "# governor overhead %.3f%% max %.3f%%: ", 100*overhead, 100*max_overhead);
+    if(m != NULL){hmon_shed_fprint(f, m, now);}
+    else{fprintf(f, "sampling 1/%u reductions 1/%u\n", stride, decimate);}
+  }
+}
+
+/* Publish a new epoch if every thread is done with the previous one. Return 1 on success, 0 if threads are busy */
+static int hmon_trigger(const long long t){
+  if(!__sync_bool_compare_and_swap(&pending, 0, nthreads)){return 0;}
+  /* Threads are idle, schedule monitors of the new epoch */
+  if(budget > 0 && epoch > 0){hmon_shed(t);}
+  if(max_overhead > 0 && epoch > 0){hmon_govern(t);}
+  trigger_time = t;
+  if(harray_length(shortened) > 0){hmon_wheel_reschedule();}
+  hmon_wheel_advance();
+  __sync_add_and_fetch(&epoch, 1);
+  hmon_wake(&epoch, &epoch_sleepers);
+  return 1;
+}
+
+/* Wait until the countdown of threads processing the last epoch reaches 0 */
+static void hmon_wait_pending(){
+  int p;
+  while((p = __sync_fetch_and_add(&pending, 0)) != 0){hmon_wait_value(&pending, p, &pending_sleepers);}
+}
+
+/* The core containing location, or NULL if location is above cores */
+static hwloc_obj_t hmon_location_core(hwloc_obj_t location){
+  if(location->type == HWLOC_OBJ_CORE){return location;}
+  return hwloc_get_ancestor_obj_by_type(hmon_topology, HWLOC_OBJ_CORE, location);
+}
+
+/* Set threads' ownership on monitors below location */
+static void hmon_set_owner(hwloc_obj_t location, pthread_t tid){
+  unsigned i;
+  if(location->userdata != NULL){
+    for(i=0; i<harray_length(location->userdata); i++){((hmon)harray_get(location->userdata, i))->owner = tid;}
+  }
+  for(i=0; i<location->arity; i++){hmon_set_owner(location->children[i], tid);}
+}
+
+void hmon_thread_attr_init(pthread_attr_t * attr){
+  struct sched_param param;
+  pthread_attr_init(attr);
+  if(rt_priority > 0){
+    param.sched_priority = rt_priority;
+    pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(attr, SCHED_FIFO);
+    pthread_attr_setschedparam(attr, &param);
+  }
+}
+
+/* Position of a core in [0,1), with topology levels as digits from the root: sockets get disjoint parts of the span */
+static double hmon_core_phase(hwloc_obj_t core){
+  double phase = 0;
+  hwloc_obj_t obj;
+  /* NUMA nodes are not ranked among normal children: use their parent position */
+  for(obj = core->type == HWLOC_OBJ_NUMANODE ? core->parent : core; obj->parent != NULL; obj = obj->parent){
+    phase = (phase + obj->sibling_rank) / obj->parent->arity;
+  }
+  return phase;
+}
+
+/* Check real-time mode can be enabled: SCHED_FIFO priority is allowed and memory can be locked */
+static int hmon_realtime_check(const int priority){
+  int err, policy;
+  struct sched_param param, save;
+  if(priority < sched_get_priority_min(SCHED_FIFO) || priority > sched_get_priority_max(SCHED_FIFO)){
+    monitor_print_err("Real-time priority %d out of SCHED_FIFO range [%d, %d]\n", priority,
+		      sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO));
+    return -1;
+  }
+  pthread_getschedparam(pthread_self(), &policy, &save);
+  param.sched_priority = priority;
+  if((err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) != 0){
+    monitor_print_err("Real-time mode: cannot set SCHED_FIFO priority %d: %s. Run as root, or with CAP_SYS_NICE or RLIMIT_RTPRIO >= %d.\n",
+		      priority, strerror(err), priority);
+    return -1;
+  }
+  pthread_setschedparam(pthread_self(), policy, &save);
+  /* Lock and prefault current and future memory */
+  if(mlockall(MCL_CURRENT|MCL_FUTURE) == -1){
+    monitor_print_err("Real-time mode: mlockall: %s. Run as root, or with CAP_IPC_LOCK or a larger RLIMIT_MEMLOCK.\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+/* Package of an object, or root if there is none */
+static hwloc_obj_t hmon_location_package(hwloc_obj_t location){
+  hwloc_obj_t obj;
+  for(obj = location; obj != NULL && obj->type != HWLOC_OBJ_PACKAGE; obj = obj->parent);
+  return obj != NULL ? obj : hwloc_get_root_obj(hmon_topology);
+}
+
+/* Set PUs where a thread runs with respect to placement policy */
+static void hmon_thread_cpuset(struct hmon_thread * t){
+  hwloc_obj_t obj, package = hmon_location_package(t->core);
+  unsigned i;
+  int n;
+  switch(placement){
+  case HMON_PLACE_HOUSEKEEPING:
+    /* The last core of each package runs all the threads of the package */
+    n = hwloc_get_nbobjs_inside_cpuset_by_type(hmon_topology, package->cpuset, HWLOC_OBJ_CORE);
+    obj = hwloc_get_obj_inside_cpuset_by_type(hmon_topology, package->cpuset, HWLOC_OBJ_CORE, n-1);
+    if(obj != NULL){hwloc_bitmap_copy(t->cpuset, obj->cpuset); return;}
+    break;
+  case HMON_PLACE_OUTSIDE:
+    /* PUs of the package left by the application, else any PU left by the application */
+    hwloc_bitmap_andnot(t->cpuset, package->cpuset, placement_avoid);
+    if(hwloc_bitmap_iszero(t->cpuset)){
+      hwloc_bitmap_andnot(t->cpuset, hwloc_topology_get_topology_cpuset(hmon_topology), placement_avoid);
+    }
+    if(!hwloc_bitmap_iszero(t->cpuset)){return;}
+    break;
+  default:
+    break;
+  }
+  /* Collectors share the PU of a core thread of their package or NUMA node, awake at every epoch anyway, else run on its last PU.
+     Core threads, spawned first, run on the last PU of their core */
+  if(t->collected != NULL){
+    for(i=0; i<ncores; i++){
+      if(threads[i].running && hwloc_bitmap_isincluded(threads[i].cpuset, t->core->cpuset)){hwloc_bitmap_copy(t->cpuset, threads[i].cpuset); return;}
+    }
+  }
+  n = hwloc_get_nbobjs_inside_cpuset_by_type(hmon_topology, t->core->cpuset, HWLOC_OBJ_PU);
+  hwloc_bitmap_copy(t->cpuset, hwloc_get_obj_inside_cpuset_by_type(hmon_topology, t->core->cpuset, HWLOC_OBJ_PU, n-1)->cpuset);
+}
+
+static void hmon_thread_spawn(struct hmon_thread * t){
+  int err;
+  pthread_attr_t attr;
+  hmon_thread_cpuset(t);
+  t->epoch = __sync_fetch_and_add(&epoch, 0);
+  t->stop = 0;
+  hmon_thread_attr_init(&attr);
+  err = pthread_create(&(t->tid), &attr, hmonitor_thread, (void*)t);
+  pthread_attr_destroy(&attr);
+  if(err != 0){
+    fprintf(stderr, "pthread_create: %s\n", strerror(err));
+    return;
+  }
+  t->running = 1;
+  nthreads++;
+}
+
+static void hmon_thread_join(struct hmon_thread * t){
+  t->stop = 1;
+  /* The thread may check stop flag right before sleeping: wake it until it acknowledges */
+  while(__sync_fetch_and_add(&t->stop, 0)){futex_wake(&epoch); sched_yield();}
+  pthread_join(t->tid, NULL);
+  t->running = 0;
+  nthreads--;
+}
+
+/* Estimated cost of updating monitors on location and its memory children */
+static unsigned long hmon_location_cost(hwloc_obj_t location){
+  unsigned i;
+  unsigned long cost = 0;
+  hmon m;
+  hwloc_obj_t mem;
+  if(location->userdata != NULL){
+    for(i=0; i<harray_length(location->userdata); i++){
+      m = harray_get(location->userdata, i);
+      cost += m->n_events + m->n_samples;
+    }
+  }
+  for(mem = location->memory_first_child; mem != NULL; mem = mem->next_sibling){cost += hmon_location_cost(mem);}
+  return cost;
+}
+
+/* Set tid ownership on monitors of location and its memory children */
+static void hmon_set_location_owner(hwloc_obj_t location, pthread_t tid){
+  unsigned i;
+  hwloc_obj_t mem;
+  if(location->userdata != NULL){
+    for(i=0; i<harray_length(location->userdata); i++){((hmon)harray_get(location->userdata, i))->owner = tid;}
+  }
+  for(mem = location->memory_first_child; mem != NULL; mem = mem->next_sibling){hmon_set_location_owner(mem, tid);}
+}
+
+/* 
+ * Give each object above cores carrying monitors to a fixed thread running inside its cpuset.
+ * Objects are assigned deepest first to the least loaded candidate, starting from the cost of the threads own monitors.
+ */
+static void hmon_owners_update(){
+  unsigned i, j, n, best;
+  int d, core_depth = hwloc_get_type_depth(hmon_topology, HWLOC_OBJ_CORE);
+  unsigned long cost, * load;
+  hmon m;
+  hwloc_obj_t obj, core;
+
+  malloc_chk(load, sizeof(*load) * nslots);
+  for(i=0; i<nslots; i++){
+    load[i] = 0;
+    if(threads[i].owned == NULL){threads[i].owned = new_harray(sizeof(hwloc_obj_t), 4, NULL);}
+    empty_harray(threads[i].owned);
+  }
+  /* Threads own monitors of their core, or of the cores they collect */
+  for(i=0; i<harray_length(monitors); i++){
+    m = harray_get(monitors, i);
+    if((core = hmon_location_core(m->location)) == NULL){continue;}
+    if(threads[core->logical_index].running){load[core->logical_index] += m->n_events + m->n_samples; continue;}
+    for(j=ncores; j<nslots; j++){
+      if(threads[j].running && hwloc_bitmap_isset(threads[j].collected, core->logical_index)){load[j] += m->n_events + m->n_samples;}
+    }
+  }
+
+  for(d=core_depth-1; d>=0; d--){
+    n = hwloc_get_nbobjs_by_depth(hmon_topology, d);
+    for(j=0; j<n; j++){
+      obj = hwloc_get_obj_by_depth(hmon_topology, d, j);
+      nodes[d][j].owner = -1;
+      if((cost = hmon_location_cost(obj)) == 0 || nodes[d][j].threads == 0){continue;}
+      for(best = nslots, i=0; i<nslots; i++){
+	if(!threads[i].running || !hwloc_bitmap_intersects(threads[i].core->cpuset, obj->cpuset)){continue;}
+	if(best == nslots || load[i] < load[best]){best = i;}
+      }
+      if(best == nslots){continue;}
+      nodes[d][j].owner = best;
+      load[best] += cost;
+      harray_push(threads[best].owned, obj);
+      hmon_set_location_owner(obj, threads[best].tid);
+    }
+  }
+  free(load);
+}
+
+/* 
+ * Spawn threads on allowed cores carrying monitors, and join threads of cores without monitors. 
+ * Cores carrying only monitors readable remotely get no thread: they are read by their package collector.
+ * Must be called while threads are idle.
+ */
+static void hmon_threads_update(){
+  unsigned i, d, depth;
+  hmon m;
+  hwloc_obj_t core, obj;
+  hwloc_bitmap_t needed = hwloc_bitmap_alloc();   /* Logical indexes of cores needing a thread */
+  hwloc_bitmap_t remote = hwloc_bitmap_alloc();   /* Logical indexes of cores read by a collector */
+  hwloc_bitmap_t left;                            /* Collected cores not assigned to a collector yet */
+  int collect_all = placement == HMON_PLACE_NUMA; /* Collectors read all monitors that can be read remotely */
+  unsigned kept = 0;                              /* Core monitors kept on their core thread despite collect_all */
+
+  /* Monitors are sorted from deepest to highest location, then cores carrying monitors are set before upper monitors are checked */
+  for(i=0; i<harray_length(monitors); i++){
+    m = harray_get(monitors, i);
+    core = hmon_location_core(m->location);
+    if(core != NULL){
+      hwloc_bitmap_set(m->remote ? remote : needed, core->logical_index);
+      if(collect_all && !m->remote){kept++;}
+      continue;
+    }
+    /* Monitors above cores are owned by a thread below them. If no core below is read, spawn a thread on the first allowed core */
+    while((core = hwloc_get_next_obj_inside_cpuset_by_type(hmon_topology, m->location->cpuset, HWLOC_OBJ_CORE, core)) != NULL){
+      if(hwloc_bitmap_isset(needed, core->logical_index) || hwloc_bitmap_isset(remote, core->logical_index)){break;}
+    }
+    if(core != NULL){continue;}
+    while((core = hwloc_get_next_obj_inside_cpuset_by_type(hmon_topology, m->location->cpuset, HWLOC_OBJ_CORE, core)) != NULL){
+      if(hwloc_bitmap_isincluded(core->cpuset, allowed_cpuset)){break;}
+    }
+    if(core != NULL){hwloc_bitmap_set(collect_all ? remote : needed, core->logical_index);}
+  }
+  /* Cores with a thread read all their monitors */
+  hwloc_bitmap_andnot(remote, remote, needed);
+  if(kept > 0){
+    fprintf(stderr, "Placement numa: %u monitors cannot be read from another cpu and keep a thread on their core\n", kept);
+  }
+
+  for(i=0; i<ncores; i++){
+    if(hwloc_bitmap_isset(needed, i) && !threads[i].running){hmon_thread_spawn(&threads[i]);}
+    else if(!hwloc_bitmap_isset(needed, i) && threads[i].running){hmon_thread_join(&threads[i]);}
+    if(threads[i].running){hmon_set_owner(threads[i].core, threads[i].tid);}
+  }
+  /* NUMA nodes cpusets may overlap: a core is collected by the first collector covering it */
+  left = hwloc_bitmap_dup(remote);
+  for(i=ncores; i<nslots; i++){
+    hwloc_bitmap_zero(threads[i].collected);
+    core = NULL;
+    while((core = hwloc_get_next_obj_inside_cpuset_by_type(hmon_topology, threads[i].core->cpuset, HWLOC_OBJ_CORE, core)) != NULL){
+      if(hwloc_bitmap_isset(left, core->logical_index)){
+	hwloc_bitmap_set(threads[i].collected, core->logical_index);
+	hwloc_bitmap_clr(left, core->logical_index);
+      }
+    }
+    if(!hwloc_bitmap_iszero(threads[i].collected) && !threads[i].running){hmon_thread_spawn(&threads[i]);}
+    else if(hwloc_bitmap_iszero(threads[i].collected) && threads[i].running){hmon_thread_join(&threads[i]);}
+    if(!threads[i].running){continue;}
+    hwloc_bitmap_foreach_begin(d, threads[i].collected){
+      hmon_set_owner(hwloc_get_obj_by_type(hmon_topology, HWLOC_OBJ_CORE, d), threads[i].tid);
+    } hwloc_bitmap_foreach_end();
+  }
+  hwloc_bitmap_free(needed);
+  hwloc_bitmap_free(left);
+
+  /* Count children with threads below each object: only the last thread of each child climbs to the object */
+  depth = (unsigned)hwloc_topology_get_depth(hmon_topology);
+  for(d=0; d<depth; d++){
+    for(i=0; i<hwloc_get_nbobjs_by_depth(hmon_topology, d); i++){nodes[d][i].threads = 0;}
+  }
+  for(i=0; i<ncores; i++){
+    /* Collected cores climb like cores with a thread */
+    if(!threads[i].running && !hwloc_bitmap_isset(remote, i)){continue;}
+    /* Stop climbing at objects already counted in their parent */
+    for(obj = threads[i].core->parent; obj != NULL; obj = obj->parent){
+      if(nodes[obj->depth][obj->logical_index].threads++ > 0){break;}
+    }
+  }
+  hwloc_bitmap_free(remote);
+  for(d=0; d<depth; d++){
+    for(i=0; i<hwloc_get_nbobjs_by_depth(hmon_topology, d); i++){nodes[d][i].pending = nodes[d][i].threads;}
+  }
+  hmon_owners_update();
+  threads_dirty = 0;
+}
+
 int hmon_import_hmonitors(const char * path){
   return hmon_import(path, allowed_cpuset);
 }
@@ -45,7 +659,8 @@ int hmon_compare(void* hmonitor_a, void* hmonitor_b){
 static void hmonitor_unregister_location(hwloc_obj_t location){
   unsigned i;
   for(i=0; i<harray_length(location->userdata); i++){
-    harray_remove(monitors, harray_find(monitors, harray_get(location->userdata,i), hmon_compare));    
+    hmon_wheel_remove(harray_get(location->userdata,i));
+    harray_remove(monitors, harray_find_unsorted(monitors, harray_get(location->userdata,i)));
   }
   delete_harray(location->userdata);
   location->userdata = NULL;
@@ -57,21 +672,28 @@ void hmon_restrict(hwloc_cpuset_t domain){
     fprintf(stderr, "forbidden restriction to a domain that is not included in current domain.\n");
     return;
   }
+  /* Threads must be idle while monitors are removed */
+  if(threads_started){hmon_wait_pending();}
+  
+  /* Cpuset to remove */
+  hwloc_cpuset_t removed = hwloc_bitmap_alloc();
+  hwloc_bitmap_andnot(removed, allowed_cpuset, domain);
   hwloc_bitmap_and(allowed_cpuset, allowed_cpuset, domain);
-  /* Now domain contain the cpuset to remove */
-  hwloc_bitmap_andnot(domain, domain, allowed_cpuset);
   
   unsigned i,nobj;
   hwloc_obj_t remove_obj;
-  harray remove_monitors;
   for(i=0;i<hwloc_topology_get_depth(hmon_topology);i++){
-    nobj = hwloc_get_nbobjs_inside_cpuset_by_depth(hmon_topology, domain, i);
+    nobj = hwloc_get_nbobjs_inside_cpuset_by_depth(hmon_topology, removed, i);
     while(nobj--){
-      remove_obj = hwloc_get_obj_inside_cpuset_by_depth(hmon_topology, domain, i, nobj);
+      remove_obj = hwloc_get_obj_inside_cpuset_by_depth(hmon_topology, removed, i, nobj);
       if(remove_obj == NULL || remove_obj->userdata == NULL){continue;}
       hmonitor_unregister_location(remove_obj);
     }
   }
+  hwloc_bitmap_free(removed);
+  
+  /* Join threads of cores without monitors left */
+  if(threads_started){hmon_threads_update();}
 }
 
 void hmon_restrict_pid(pid_t pid){
@@ -96,11 +718,45 @@ void hmon_restrict_pid_taskset(pid_t pid, int recurse){
   hwloc_bitmap_free(running_cpuset);
 }
 
-int hmon_lib_init(const hwloc_topology_t topo){
-  unsigned i;
+static void hmon_thread_init(struct hmon_thread * t, hwloc_obj_t obj, const int collector){
+  t->core = obj;
+  t->collected = collector ? hwloc_bitmap_alloc() : NULL;
+  t->cpuset = hwloc_bitmap_alloc();
+  t->running = 0;
+  memset(t->times, 0, sizeof(t->times));
+  memset(&t->stats, 0, sizeof(t->stats));
+  t->done = 0;
+  t->finish = 0;
+  t->owned = NULL;
+  t->phase = hmon_core_phase(obj);
+}
+
+static void hmon_thread_fini(struct hmon_thread * t){
+  if(t->collected != NULL){hwloc_bitmap_free(t->collected);}
+  if(t->owned != NULL){delete_harray(t->owned);}
+  hwloc_bitmap_free(t->cpuset);
+}
+
+/* Prepare one collector per object of type, or a single one on the root if there is none */
+static void hmon_collectors_init(const hwloc_obj_type_t type){
+  unsigned i, n = hwloc_get_nbobjs_by_type(hmon_topology, type);
+  for(i=ncores; i<nslots; i++){hmon_thread_fini(&threads[i]);}
+  nslots = ncores + (n > 0 ? n : 1);
+  realloc_chk(threads, sizeof(*threads)*nslots);
+  for(i=ncores; i<nslots; i++){
+    hmon_thread_init(&threads[i], n > 0 ? hwloc_get_obj_by_type(hmon_topology, type, i-ncores) : hwloc_get_root_obj(hmon_topology), 1);
+  }
+}
+
+int hmon_lib_init(const hwloc_topology_t topo, const int priority){
+  unsigned i, j, depth;
   /* Check hwloc version */
   if(hwloc_check_version_mismatch() != 0){return -1;}
 
+  /* Check privileges for real-time mode */
+  if(priority > 0 && hmon_realtime_check(priority) == -1){return -1;}
+  rt_priority = priority > 0 ? priority : 0;
+
   /* initialize topology */
   if(topo == NULL){
     hwloc_topology_init(&hmon_topology); 
@@ -122,13 +778,36 @@ int hmon_lib_init(const hwloc_topology_t topo){
   monitors = new_harray(sizeof(hmon), 32, (void (*)(void *))delete_hmonitor);
   allowed_cpuset = hwloc_bitmap_dup(hwloc_topology_get_complete_cpuset((hmon_topology)));
 
-  /* Create one thread per core */
+  /* Create the scheduler of monitors */
+  wheel_tick = 0;
+  for(i=0; i<2; i++){
+    for(j=0; j<WHEEL_SIZE; j++){wheel[i][j] = new_harray(sizeof(hmon), 4, NULL);}
+  }
+  shortened = new_harray(sizeof(hmon), 16, NULL);
+  govern_files = new_harray(sizeof(FILE*), 4, NULL);
+
+  /* Prepare one thread per core, and one collector per package. Threads are spawned on start, where monitors are */
   ncores = hwloc_get_nbobjs_by_type(hmon_topology, HWLOC_OBJ_CORE);
-  pthread_barrier_init(&barrier, NULL, ncores+1);
-  threads = malloc(sizeof(*threads)*ncores);
-  for(i = 0; i<ncores; i++){
-    hwloc_obj_t core = hwloc_get_obj_by_type(hmon_topology, HWLOC_OBJ_CORE, i);
-    pthread_create(&(threads[i]), NULL, hmonitor_thread, (void*)(core));
+  nslots = ncores;
+  threads = NULL;
+  hmon_collectors_init(HWLOC_OBJ_PACKAGE);
+  for(i=0; i<ncores; i++){hmon_thread_init(&threads[i], hwloc_get_obj_by_type(hmon_topology, HWLOC_OBJ_CORE, i), 0);}
+  placement = HMON_PLACE_CORE;
+  nthreads = 0;
+  epoch = pending = snapshot_epoch = output_epoch = threads_started = threads_dirty = 0;
+  output_time = 0;
+  relax = 0;
+  govern_level = govern_epochs = 0;
+  govern_time = 0;
+  govern_cpu = 0;
+  stride = decimate = 1;
+  requests = 0;
+  memset(&epoch_stats, 0, sizeof(epoch_stats));
+  depth = (unsigned)hwloc_topology_get_depth(hmon_topology);
+  malloc_chk(nodes, sizeof(*nodes)*depth);
+  for(i=0; i<depth; i++){
+    malloc_chk(nodes[i], sizeof(**nodes)*hwloc_get_nbobjs_by_depth(hmon_topology, i));
+    memset(nodes[i], 0, sizeof(**nodes)*hwloc_get_nbobjs_by_depth(hmon_topology, i));
   }
 
   return 0;
@@ -145,21 +824,198 @@ int hmon_register_hmonitor(hmon m, int display){
   /* Add monitor to existing monitors*/
   harray_insert_sorted(monitors, m, hmon_compare);
   
-  /* Store monitor on topology */
+  /* Store monitor on topology. Ownership is set when threads are spawned */
   if(m->location->userdata == NULL){m->location->userdata = new_harray(sizeof(m), 4, NULL);}
-  if(m->location->type == HWLOC_OBJ_CORE){ m->owner = threads[m->location->logical_index]; }
-  if(m->location->type == HWLOC_OBJ_PU){ m->owner = threads[m->location->parent->logical_index]; }  
   harray_insert_sorted(m->location->userdata, m, hmon_compare);
+  threads_dirty = 1;
+
+  /* Heavy reductions are left to the worker pool */
+  if(m->heavy){hmon_offload_attach(m);}
+
+  /* Schedule monitor for next epoch. Adaptive monitors start at their shortest period */
+  if(m->period_max > m->period_min){m->period = m->period_min;}
+  if(m->period == 0){m->period = 1;}
+  m->next = wheel_tick + 1;
+  hmon_wheel_insert(m);
   return 0;
 }
 
+/* Snapshot monitors of the last epoch if it is complete and it was not already done */
+static void hmon_snapshot(){
+  int e = __sync_fetch_and_add(&epoch, 0);
+  if(e > snapshot_epoch && hmon_is_uptodate()){
+    hmonitors_do(monitors, hmonitor_snapshot);
+    snapshot_epoch = e;
+  }
+}
+
+/* Account an update dropped because threads are busy, globally and on busy threads */
+static void hmon_skip(){
+  unsigned i;
+  int e = __sync_fetch_and_add(&epoch, 0);
+  epoch_stats.skipped++;
+  for(i=0; i<nslots; i++){
+    if(threads[i].running && __sync_fetch_and_add(&threads[i].done, 0) != e){threads[i].stats.skipped++;}
+  }
+}
+
+int hmon_update_async(){
+  /* Request time is the reference of the epoch deadline, even if the request waits for busy threads */
+  long long t = hmon_clock();
+  /* The governor lowered the sampling rate */
+  if(requests++ % stride){return 0;}
+  if(!hmon_is_uptodate()){
+    if(miss_policy == HMON_MISS_DROP){hmon_skip(); return 0;}
+    hmon_wait_pending();
+  }
+  /* Spawn threads for monitors registered after start */
+  if(threads_started && threads_dirty){hmon_threads_update();}
+  /* Save last epoch output before it is overwritten */
+  hmon_snapshot();
+  if(!hmon_trigger(t)){return 0;}
+  return __sync_fetch_and_add(&epoch, 0);
+}
+
+int hmon_poll(const int e){
+  int current = __sync_fetch_and_add(&epoch, 0);
+  return e < current || (e == current && hmon_is_uptodate());
+}
+
+void hmon_wait(const int e){
+  if(e == __sync_fetch_and_add(&epoch, 0)){hmon_wait_pending();}
+}
+
+void hmon_output(){
+  long long t;
+  hmon_snapshot();
+  if(snapshot_epoch > output_epoch){
+    t = hmon_clock();
+    hmonitors_do(monitors, hmonitor_output, 1);
+    output_epoch = snapshot_epoch;
+    output_time += hmon_clock() - t;
+  }
+}
+
+void hmon_set_miss_policy(const int policy){miss_policy = policy;}
+
+int hmon_get_miss_policy(){return miss_policy;}
+
+void hmon_set_deadline(const long long ns){deadline = ns;}
+
+void hmon_set_stagger(const long long ns){stagger = ns > 0 ? ns : 0;}
+
+void hmon_set_budget(const long long ns){
+  unsigned i;
+  budget = ns > 0 ? ns : 0;
+  if(budget == 0 || harray_length(monitors) == 0){return;}
+  /* The highest priority is never shed */
+  for(i=1; i<harray_length(monitors); i++){
+    if(((hmon)harray_get(monitors, i))->priority != ((hmon)harray_get(monitors, 0))->priority){return;}
+  }
+  fprintf(stderr, "Load shedding: every monitor has PRIORITY %d, none will be shed\n", ((hmon)harray_get(monitors, 0))->priority);
+}
+
+void hmon_set_max_overhead(const double share){max_overhead = share > 0 ? share : 0;}
+
+/* Add CPUs listed in a sysfs file, e.g. "1-3,8", to set. Missing or empty files add nothing */
+static void hmon_read_cpulist(const char * path, hwloc_bitmap_t set){
+  char list[4096];
+  hwloc_bitmap_t cpus;
+  FILE * f = fopen(path, "r");
+  if(f == NULL){return;}
+  cpus = hwloc_bitmap_alloc();
+  if(fgets(list, sizeof(list), f) != NULL && list[0] != '\n' && hwloc_bitmap_list_sscanf(cpus, list) == 0){hwloc_bitmap_or(set, set, cpus);}
+  hwloc_bitmap_free(cpus);
+  fclose(f);
+}
+
+int hmon_set_placement(const int policy, hwloc_const_cpuset_t cpuset){
+  if(threads_started){monitor_print_err("Threads placement must be set before hmon_start()\n"); return -1;}
+  if(policy < HMON_PLACE_CORE || policy > HMON_PLACE_NUMA){monitor_print_err("Invalid placement policy %d\n", policy); return -1;}
+  if(policy == HMON_PLACE_OUTSIDE){
+    if(placement_avoid == NULL){placement_avoid = hwloc_bitmap_alloc();}
+    hwloc_bitmap_zero(placement_avoid);
+    /* Default to CPUs isolated from the scheduler or from the timer tick: the application runs there */
+    if(cpuset != NULL){hwloc_bitmap_copy(placement_avoid, cpuset);}
+    else{
+      hmon_read_cpulist("/sys/devices/system/cpu/isolated", placement_avoid);
+      hmon_read_cpulist("/sys/devices/system/cpu/nohz_full", placement_avoid);
+    }
+    if(hwloc_bitmap_iszero(placement_avoid)){
+      monitor_print_err("No cpuset to avoid: none given, and no isolated or nohz_full CPU\n");
+      return -1;
+    }
+    if(hwloc_bitmap_isincluded(hwloc_topology_get_topology_cpuset(hmon_topology), placement_avoid)){
+      monitor_print_err("No PU left outside of the avoided cpuset\n");
+      return -1;
+    }
+  }
+  /* Collectors are per NUMA node for the numa policy, per package otherwise */
+  if((policy == HMON_PLACE_NUMA) != (placement == HMON_PLACE_NUMA)){
+    hmon_collectors_init(policy == HMON_PLACE_NUMA ? HWLOC_OBJ_NUMANODE : HWLOC_OBJ_PACKAGE);
+  }
+  placement = policy;
+  return 0;
+}
+
+void hmon_epoch_stats(hwloc_obj_t core, struct hmon_epoch_stats * stats){
+  unsigned i;
+  if(core == NULL){*stats = epoch_stats; return;}
+  if(core->type == HWLOC_OBJ_CORE){*stats = threads[core->logical_index].stats; return;}
+  memset(stats, 0, sizeof(*stats));
+  for(i=ncores; i<nslots; i++){if(threads[i].core == core){*stats = threads[i].stats;}}
+}
+
+/* Write epochs accounting, and monitors of f which read children from older epochs or were shed, as comment lines into f */
+static void hmon_epoch_stats_fprint(FILE * f){
+  unsigned i;
+  hmon m;
+  fprintf(f, "# epochs %lu skipped %lu late %lu lateness_max %lld deadline %lld policy %s\n",
+	  epoch_stats.epochs, epoch_stats.skipped, epoch_stats.late, epoch_stats.lateness_max, deadline,
+	  miss_policy == HMON_MISS_CATCHUP ? "catchup" : "drop");
+  for(i=0; i<nslots; i++){
+    if(threads[i].stats.epochs == 0){continue;}
+    fprintf(f, "# %8s:%u epochs %lu skipped %lu late %lu lateness_max %lld\n",
+	    hwloc_type_name(threads[i].core->type), threads[i].core->logical_index,
+	    threads[i].stats.epochs, threads[i].stats.skipped, threads[i].stats.late, threads[i].stats.lateness_max);
+  }
+  for(i=0; i<harray_length(monitors); i++){
+    m = harray_get(monitors, i);
+    if(m->output != f){continue;}
+    if(m->stale > 0){
+      fprintf(f, "# %8s:%u %s stale reads %lu of %u\n",
+	      hwloc_type_name(m->location->type), m->location->logical_index, m->id, m->stale, m->total);
+    }
+    if(m->shed_time > 0 || m->shed > 0){
+      fprintf(f, "# %8s:%u %s priority %d shed %llu ns\n",
+	      hwloc_type_name(m->location->type), m->location->logical_index, m->id, m->priority,
+	      m->shed_time + (m->shed > 0 ? hmon_clock() - m->shed_start : 0));
+    }
+  }
+  fflush(f);
+}
+
+void hmon_self_times(hwloc_obj_t location, unsigned long long times[HMON_PHASE_COUNT]){
+  unsigned i, p;
+  hwloc_obj_t core = hmon_location_core(location);
+  memset(times, 0, sizeof(*times) * HMON_PHASE_COUNT);
+  for(i=0; i<nslots; i++){
+    /* Collected cores are read by the collector of their package or NUMA node */
+    if(core != NULL){
+      if(threads[i].core != core && (threads[i].collected == NULL || !hwloc_bitmap_isset(threads[i].collected, core->logical_index))){continue;}
+    }
+    else if(!hwloc_bitmap_isincluded(threads[i].core->cpuset, location->cpuset)){continue;}
+    for(p=0; p<HMON_PHASE_COUNT; p++){times[p] += threads[i].times[p];}
+  }
+  times[HMON_PHASE_OUTPUT] = output_time;
+}
+
 void hmon_update(const int output){
-  /* Check that all monitors or uptodate */
-  if(__sync_bool_compare_and_swap(&uptodate, 0, ncores)){
-    /* Trigger monitors */
-    pthread_barrier_wait(&barrier);
-    pthread_barrier_wait(&barrier);
-    if(output) hmonitors_do(monitors, hmonitor_output, 1);
+  /* Trigger monitors if all threads are uptodate, and wait for completion */
+  int e = hmon_update_async();
+  if(e){
+    hmon_wait(e);
+    if(output) hmon_output();
   }
 }
 
@@ -170,15 +1026,27 @@ harray hmon_get_monitors_by_depth(unsigned depth, unsigned logical_index){
 }
 
 void hmon_lib_finalize(){
-  unsigned i, j;
+  unsigned i, j, depth = (unsigned)hwloc_topology_get_depth(hmon_topology);
   /* Stop monitors */
-  threads_stop = 1;
-  pthread_barrier_wait(&barrier);
-  pthread_barrier_wait(&barrier);
-  for(i=0;i<thread_count;i++){pthread_join(threads[i],NULL);}
+  hmon_wait_pending();
+  for(i=0;i<nslots;i++){if(threads[i].running){hmon_thread_join(&threads[i]);}}
+  /* Write trace metadata once per output */
+  harray files = hmon_output_files(new_harray(sizeof(FILE*), 4, NULL));
+  for(i=0; i<harray_length(files); i++){hmon_epoch_stats_fprint(harray_get(files, i));}
+  delete_harray(files);
   /* Cleanup */
+  for(i=0; i<nslots; i++){hmon_thread_fini(&threads[i]);}
   free(threads);
-  for(i=0; i<hwloc_topology_get_depth(hmon_topology); i++){
+  if(placement_avoid != NULL){hwloc_bitmap_free(placement_avoid);}
+  placement_avoid = NULL;
+  for(i=0; i<depth; i++){free(nodes[i]);}
+  free(nodes);
+  for(i=0; i<2; i++){
+    for(j=0; j<WHEEL_SIZE; j++){delete_harray(wheel[i][j]);}
+  }
+  delete_harray(shortened);
+  delete_harray(govern_files);
+  for(i=0; i<depth; i++){
     for(j=0;j<hwloc_get_nbobjs_by_depth(hmon_topology,i);j++){
       hwloc_obj_t obj = hwloc_get_obj_by_depth(hmon_topology, i, j);
       if(obj->userdata){delete_harray(obj->userdata);}
@@ -188,8 +1056,11 @@ void hmon_lib_finalize(){
   /* Close opened files */
   delete_harray(outputs);
   delete_harray(monitors);
+  hmon_offload_finalize();
+  hmon_arena_finalize();
   hwloc_bitmap_free(allowed_cpuset);
   hwloc_topology_destroy(hmon_topology);
+  if(rt_priority > 0){munlockall();}
 }
 
 
@@ -202,7 +1073,33 @@ static void hmon_stop_hmonitor(hmon m){
   }
 }
 
+int hmon_threads_on(hwloc_const_cpuset_t cpuset){
+  unsigned i;
+  if(!threads_started){return -1;}
+  for(i=0; i<nslots; i++){
+    if(threads[i].running && hwloc_bitmap_intersects(threads[i].cpuset, cpuset)){return 1;}
+  }
+  return 0;
+}
+
 void hmon_start(){
+  unsigned i, j;
+  /* Import is done: spawn threads where monitors are */
+  if(!threads_started || threads_dirty){
+    hmon_wait_pending();
+    hmon_threads_update();
+    threads_started = 1;
+  }
+  /* Real-time mode: size scheduler slots, rescheduling list, governor files and reduction deques for every monitor to avoid reallocations while sampling, and lock new memory */
+  if(rt_priority > 0){
+    for(i=0; i<2; i++){
+      for(j=0; j<WHEEL_SIZE; j++){harray_reserve(wheel[i][j], harray_length(monitors)+1);}
+    }
+    harray_reserve(shortened, harray_length(monitors));
+    harray_reserve(govern_files, harray_length(monitors));
+    hmon_offload_reserve(harray_length(monitors));
+    if(mlockall(MCL_CURRENT|MCL_FUTURE) == -1){perror("mlockall");}
+  }
   hmonitors_do(monitors, hmonitor_start);
 }
 
@@ -210,61 +1107,233 @@ void hmon_stop(){
   hmonitors_do(monitors, hmonitor_stop);
 }
 
+void hmon_freerun(const int freerun){
+  unsigned i;
+  for(i=0; i<harray_length(monitors); i++){((hmon)harray_get(monitors, i))->freerun = freerun;}
+}
+
 int hmon_is_uptodate(){
-  return __sync_fetch_and_and(&uptodate, 0);
+  return __sync_fetch_and_add(&pending, 0) == 0;
+}
+
+/* Read monitor unless it was already read by a parent monitor during this epoch */
+static int hmon_read_due(hmon m){
+  if(m->epoch == m->due){return 1;}
+  return hmonitor_read(m);
 }
 
-/* Update monitors from a location from children to */
-static void hmon_update_location(hwloc_obj_t location, int recurse_down, int recurse_up, int (*update)(hmon)){
-  if(location == NULL){return;}
+/* Update monitors due at epoch e on location, its memory children, and below location if recurse_down is set */
+static void hmon_update_location(hwloc_obj_t location, int recurse_down, int (*update)(hmon), const int e){
+  unsigned i;
+  hmon m;
+  hwloc_obj_t mem;
   harray _monitors = location->userdata;
-  if(_monitors != NULL){hmonitors_do(_monitors, update);}
+  if(_monitors != NULL){
+    for(i=0; i<harray_length(_monitors); i++){
+      m = harray_get(_monitors, i);
+      if(m->due == e){update(m);}
+    }
+  }
+  for(mem = location->memory_first_child; mem != NULL; mem = mem->next_sibling){hmon_update_location(mem, 0, update, e);}
   if(recurse_down){
-    unsigned i;
-    for(i=0; i<location->arity; i++){hmon_update_location(location->children[i], 1, 0, update);}
+    for(i=0; i<location->arity; i++){hmon_update_location(location->children[i], 1, update, e);}
   }
-  if(recurse_up){
-    hmon_update_location(location->parent, 0, 1, update);
+}
+
+/* Stop event collection. Free-running monitors are only acquired */
+static int hmon_stop_due(hmon m){
+  if(m->freerun && !m->stopped){return m->owner == pthread_self() || hmonitor_trylock(m, 0) == 1;}
+  return hmonitor_stop(m);
+}
+
+/* Restart event collection. Free-running monitors are only released */
+static int hmon_start_due(hmon m){
+  if(m->freerun && !m->stopped){return hmonitor_release(m);}
+  return hmonitor_start(m);
+}
+
+/* Reschedule a monitor on its shorter period at next trigger, instead of waiting for its former next epoch */
+static void hmon_shorten(hmon m){
+  pthread_mutex_lock(&shortened_lock);
+  /* Listed once, so the list never outgrows the monitors */
+  if(harray_find_unsorted(shortened, m) < 0){harray_push(shortened, m);}
+  pthread_mutex_unlock(&shortened_lock);
+}
+
+/* Shorten period of adaptive monitors below location, down to period */
+static void hmon_adapt_subtree(hwloc_obj_t location, const unsigned period){
+  unsigned i;
+  hmon m;
+  hwloc_obj_t mem;
+  harray _monitors = location->userdata;
+  if(_monitors != NULL){
+    for(i=0; i<harray_length(_monitors); i++){
+      m = harray_get(_monitors, i);
+      if(m->period_max > m->period_min && m->period > period){
+	m->period = MAX(period, m->period_min);
+	hmon_shorten(m);
+      }
+    }
+  }
+  for(mem = location->memory_first_child; mem != NULL; mem = mem->next_sibling){hmon_adapt_subtree(mem, period);}
+  for(i=0; i<location->arity; i++){hmon_adapt_subtree(location->children[i], period);}
+}
+
+/* Adapt monitor period to its samples: halve it when a sample moved by more than HMON_ADAPT_HIGH of its observed range
+   since previous sample, double it when every sample moved by less than HMON_ADAPT_LOW. A shorter period applies to the
+   monitor and adaptive monitors below it from the next epoch they are due, counted from their last due epoch */
+static int hmon_adapt(hmon m){
+  unsigned i, period = m->period;
+  double range, delta, max_delta = 0;
+  hwloc_obj_t mem;
+  if(m->period_max > m->period_min && m->total > 1){
+    for(i=0; i<m->n_samples; i++){
+      range = m->max[i] - m->min[i];
+      delta = m->samples[i] > m->previous[i] ? m->samples[i] - m->previous[i] : m->previous[i] - m->samples[i];
+      if(range > 0){max_delta = MAX(max_delta, delta / range);}
+    }
+    if(max_delta > HMON_ADAPT_HIGH){period = MAX(period/2, m->period_min);}
+    else if(max_delta < HMON_ADAPT_LOW){period = MIN(period*2, m->period_max);}
+    if(period < m->period){
+      for(mem = m->location->memory_first_child; mem != NULL; mem = mem->next_sibling){hmon_adapt_subtree(mem, period);}
+      for(i=0; i<m->location->arity; i++){hmon_adapt_subtree(m->location->children[i], period);}
+      hmon_shorten(m);
+    }
+    m->period = period;
+  }
+  memcpy(m->previous, m->samples, sizeof(*m->samples) * m->n_samples);
+  return 1;
+}
+
+/* Reduce and adapt a monitor, on one read out of decimate */
+static int hmon_reduce_due(hmon m){
+  if(decimate > 1 && m->total % decimate){return 1;}
+  /* Heavy reductions still running did not publish samples to adapt to */
+  if(hmonitor_reduce(m) != 1){return 1;}
+  return hmon_adapt(m);
+}
+
+/* Add time elapsed since *t to phase, and restart *t */
+static inline void hmon_phase_time(unsigned long long * times, const int phase, long long * t){
+  long long now = hmon_clock();
+  times[phase] += now - *t;
+  *t = now;
+}
+
+/* Stop, read, reduce and restart monitors due at epoch e. Phases time is added to times */
+static void hmon_update_epoch(hwloc_obj_t location, int recurse_down, const int e, unsigned long long * times){
+  long long t = hmon_clock();
+  /* Stop event collection */
+  hmon_update_location(location, recurse_down, hmon_stop_due, e);
+  hmon_phase_time(times, HMON_PHASE_STOP, &t);
+  /* Read monitors */
+  hmon_update_location(location, recurse_down, hmon_read_due, e);
+  hmon_phase_time(times, HMON_PHASE_READ, &t);
+  /* Analyze monitors */
+  hmon_update_location(location, recurse_down, hmon_reduce_due, e);
+  hmon_phase_time(times, HMON_PHASE_REDUCE, &t);
+  /* Restart event collection */
+  hmon_update_location(location, recurse_down, hmon_start_due, e);
+  hmon_phase_time(times, HMON_PHASE_START, &t);
+}
+
+/* Account an epoch completed late nanoseconds after its deadline */
+static inline void hmon_account(struct hmon_epoch_stats * stats, const long long late){
+  stats->epochs++;
+  if(deadline > 0 && late > 0){
+    stats->late++;
+    stats->lateness_max = MAX(stats->lateness_max, late);
+  }
+}
+
+/* Count a child done below location. Return 1 if it is the last one, then location can be updated */
+static int hmon_node_arrive(hwloc_obj_t location){
+  struct hmon_node * node = &nodes[location->depth][location->logical_index];
+  if(__sync_sub_and_fetch(&node->pending, 1) != 0){return 0;}
+  /* Nobody else touches the countdown until next epoch */
+  node->pending = node->threads;
+  return 1;
+}
+
+/* Climb up the topology from location while this thread is the last child done. Hand the first object with monitors to its owner */
+static void hmon_climb(hwloc_obj_t location, const int e){
+  struct hmon_node * node;
+  for(; location != NULL && hmon_node_arrive(location); location = location->parent){
+    node = &nodes[location->depth][location->logical_index];
+    if(node->owner < 0){continue;}
+    __sync_lock_test_and_set(&node->ready, e);
+    hmon_wake(&node->ready, &node->sleepers);
+    return;
+  }
+}
+
+/* Update objects owned by self, deepest first, once their children are done: parents always see fresh children */
+static void hmon_update_owned(struct hmon_thread * self){
+  unsigned i;
+  int r;
+  long long t;
+  hwloc_obj_t obj;
+  struct hmon_node * node;
+  for(i=0; i<harray_length(self->owned); i++){
+    obj = harray_get(self->owned, i);
+    node = &nodes[obj->depth][obj->logical_index];
+    t = hmon_clock();
+    while((r = __sync_fetch_and_add(&node->ready, 0)) != self->epoch){hmon_wait_value(&node->ready, r, &node->sleepers);}
+    hmon_phase_time(self->times, HMON_PHASE_WAIT, &t);
+    hmon_update_epoch(obj, 0, self->epoch, self->times);
+    hmon_climb(obj->parent, self->epoch);
   }
 }
 
 static void * hmonitor_thread(void * arg)
 {
-  hwloc_obj_t Core = (hwloc_obj_t)(arg);
-  /* Bind the thread */
-  hwloc_obj_t PU = hwloc_get_obj_inside_cpuset_by_type(hmon_topology,
-						       Core->cpuset,
-						       HWLOC_OBJ_PU,
-						       hwloc_get_nbobjs_inside_cpuset_by_type(hmon_topology,
-											      Core->cpuset,
-											      HWLOC_OBJ_PU) -1);
-  location_cpubind(hmon_topology, PU);
+  struct hmon_thread * self = (struct hmon_thread *)(arg);
+  hwloc_obj_t obj, Core = self->core;
+  long long t;
+  unsigned i;
+  /* Bind the thread where placement policy put it */
+  cpuset_cpubind(hmon_topology, self->cpuset);
 
   /* Collect events */
 hmon_thread_loop:
-  /* Enter thread safe area */
-  pthread_barrier_wait(&barrier);
+  /* Sleep until next epoch is published */
+  t = hmon_clock();
+  while(__sync_fetch_and_add(&epoch, 0) == self->epoch && !self->stop){hmon_wait_value(&epoch, self->epoch, &epoch_sleepers);}
   /* check for stop */
-  if(threads_stop){goto hmon_thread_exit;}
-  /* Sleep until next update */
-  pthread_barrier_wait(&barrier);
-    
-  /* Stop event collection */
-  hmon_update_location(Core, 1, 1, hmonitor_stop);
-  /* Read monitors */
-  hmon_update_location(Core, 1, 1, hmonitor_read);
-  /* Analyze monitors */
-  hmon_update_location(Core, 1, 1, hmonitor_reduce);
-  /* output monitors */
-  /* hmon_update_location(Core, 1, 1, (int (*)(struct hmon *))hmonitor_output); */
-  /* Signal we are uptodate */
-  __sync_fetch_and_sub(&uptodate, 1);
-  /* Restart event collection */
-  hmon_update_location(Core, 1, 1, hmonitor_start);
+  if(self->stop){goto hmon_thread_exit;}
+  self->epoch = __sync_fetch_and_add(&epoch, 0);
+  /* Wait for this core turn. Monitors timestamp their own reads */
+  if(stagger > 0){hmon_wait_until(trigger_time + (long long)(self->phase * stagger));}
+  hmon_phase_time(self->times, HMON_PHASE_WAIT, &t);
+
+  /* Update monitors below the core, or below each collected core, then objects owned by this thread */
+  if(self->collected == NULL){
+    hmon_update_epoch(Core, 1, self->epoch, self->times);
+    hmon_climb(Core->parent, self->epoch);
+  }
+  else{
+    hwloc_bitmap_foreach_begin(i, self->collected){
+      obj = hwloc_get_obj_by_type(hmon_topology, HWLOC_OBJ_CORE, i);
+      hmon_update_epoch(obj, 1, self->epoch, self->times);
+      hmon_climb(obj->parent, self->epoch);
+    } hwloc_bitmap_foreach_end();
+  }
+  hmon_update_owned(self);
+  
+  /* Account lateness */
+  self->finish = hmon_clock();
+  t = self->finish - trigger_time - deadline;
+  hmon_account(&self->stats, t);
+  __sync_lock_test_and_set(&self->done, self->epoch);
+
+  /* Signal we are uptodate. Last thread accounts global lateness and wakes up the trigger */
+  if(__sync_sub_and_fetch(&pending, 1) == 0){
+    hmon_account(&epoch_stats, t);
+    hmon_wake(&pending, &pending_sleepers);
+  }
   goto hmon_thread_loop;
 
 hmon_thread_exit:
-  pthread_barrier_wait(&barrier);
+  __sync_fetch_and_and(&self->stop, 0);
   return NULL;  
 }
-
@@ -155,7 +155,7 @@ class Monitors:
         #select xcol and ycol
         if(xcol == None): self.xcol = self.data.columns[1]
         else: self.xcol = xcol        
-        if(ycol == None): self.ycol = self.data.columns[2]
+        if(ycol == None): self.ycol = [c for c in self.data.columns[2:] if c not in ('Epoch', 'Period')][0]
         else: self.ycol = ycol
         
         #prepare color rainbow        
@@ -165,7 +165,7 @@ class Monitors:
     def fromfilename(cls, fname, name=None, xcol = None, ycol=None):
         #Store id for title
         if(name == None): name = os.path.basename(fname)
-        df = pd.read_table(fname, delim_whitespace=True)
+        df = pd.read_table(fname, delim_whitespace=True, comment='#')
         return cls(df, name, xcol, ycol)
 
     def pipeline(self, n_stage):
@@ -191,7 +191,7 @@ class Monitors:
         if(data is None): data = self.data
         if(not "NORMALIZED" in self.name.upper()): self.name = "Normalized " + self.name
         cols = data.columns
-        X = data.ix[:, (cols != self.ycol) & (cols != 'Obj') & (cols != 'Nanoseconds')]
+        X = data.ix[:, (cols != self.ycol) & (cols != 'Obj') & (cols != 'Nanoseconds') & (cols != 'Epoch') & (cols != 'Period')]
         cst = self.data[['Obj', 'Nanoseconds', self.ycol]]
         X = pd.DataFrame(preprocessing.normalize(X.values), columns=X.columns)
         cst.index = X.index
@@ -200,7 +200,7 @@ class Monitors:
     def get_Xy(self, data=None):
         if(data is None): data = self.data            
         y = data[self.ycol]
-        X = data.ix[:, (data.columns != self.ycol) & (data.columns != 'Obj') & (data.columns != 'Nanoseconds')]
+        X = data.ix[:, (data.columns != self.ycol) & (data.columns != 'Obj') & (data.columns != 'Nanoseconds') & (data.columns != 'Epoch') & (data.columns != 'Period')]
         return X.values, y.values
 
     def train_test_split(self, data=None, test_size=None, train_size=None, random=False):
@@ -396,7 +396,7 @@ class Monitor(Monitors):
     def pipeline(self, n_stage = 0):
         if(n_stage <= 0): return
         cols = self.data.columns
-        tmp = self.data.ix[:, (cols != 'Obj') & (cols != 'Nanoseconds') & (cols != self.ycol)].copy()
+        tmp = self.data.ix[:, (cols != 'Obj') & (cols != 'Nanoseconds') & (cols != 'Epoch') & (cols != 'Period') & (cols != self.ycol)].copy()
         
         for i in range(n_stage):
             #Create new data frame without 'Obj' and y columns            